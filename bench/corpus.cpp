@@ -0,0 +1,140 @@
+#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+#include <sstream>
+
+#include "corpus.hpp"
+
+namespace {
+
+struct Random {
+    uint32_t seed;
+    
+    uint32_t next() {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) & 0x7FFF;
+    }
+    
+    uint32_t below(uint32_t count) { return next() % count; }
+};
+
+}
+
+//
+// Parses a whole number in [min, max]
+//
+bool parseNumber(const std::string &text, long long min, long long max, long long &value) {
+    const char *start = text.c_str();
+    char *end = nullptr;
+    errno = 0;
+    long long parsed = strtoll(start, &end, 10);
+    if (end == start || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) return false;
+    value = parsed;
+    return true;
+}
+
+//
+// Parses a mix written as six comma separated weights
+//
+bool parseMix(std::string text, CorpusMix &mix) {
+    int *weights[] = { &mix.rtype, &mix.itype, &mix.load, &mix.store, &mix.branch, &mix.fp };
+    std::istringstream reader(text);
+    std::string item;
+    int count = 0;
+    int total = 0;
+    while (std::getline(reader, item, ',')) {
+        long long weight;
+        if (count == 6 || !parseNumber(item, 0, 1000000, weight)) return false;
+        *weights[count] = (int)weight;
+        total += *weights[count];
+        ++count;
+    }
+    return count == 6 && total > 0;
+}
+
+//
+// Builds a source of exactly options.lines lines
+//
+std::string generateCorpus(const CorpusOptions &options) {
+    static const char *rtype[] = { "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and" };
+    static const char *itype[] = { "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai" };
+    static const char *load[] = { "lb", "lh", "lw", "lbu", "lhu" };
+    static const char *store[] = { "sb", "sh", "sw" };
+    static const char *branch[] = { "beq", "bne", "blt", "bge", "bltu", "bgeu" };
+    static const char *comments[] = {
+        "; spill the loop counter",
+        "; reload after the call",
+        "; advance the pointer",
+        "; check the bound"
+    };
+    
+    const CorpusMix &mix = options.mix;
+    const int weights[] = { mix.rtype, mix.itype, mix.load, mix.store, mix.branch, mix.fp };
+    int total = 0;
+    for (int weight : weights) total += weight;
+    
+    Random random = { options.seed };
+    auto reg = [&]() { return random.below(32); };
+    
+    int every = options.labelEvery > 0 ? options.labelEvery : options.lines + 1;
+    int labels = (options.lines + every - 1) / every;
+    int span = 1000 / every < 8 ? 1000 / every : 8;
+    
+    // Each line is short, so a rough guess saves most of the regrowth
+    std::string source = "";
+    source.reserve((size_t)options.lines * 24);
+    char line[128];
+    
+    for (int i = 0; i<options.lines; i++) {
+        if (i % every == 0) {
+            source += "L" + std::to_string(i / every) + ":\n";
+            continue;
+        }
+        
+        uint32_t pick = random.below(total);
+        int kind = 0;
+        while (pick >= (uint32_t)weights[kind]) {
+            pick -= weights[kind];
+            ++kind;
+        }
+        
+        int length = 0;
+        switch (kind) {
+            case 0: length = snprintf(line, sizeof(line), "%s x%u, x%u, x%u", rtype[random.below(10)], reg(), reg(), reg()); break;
+            case 1: length = snprintf(line, sizeof(line), "%s x%u, x%u, %u", itype[random.below(9)], reg(), reg(), random.below(31)); break;
+            case 2: length = snprintf(line, sizeof(line), "%s x%u, %u(x%u)", load[random.below(5)], reg(), random.below(64) * 4, reg()); break;
+            case 3: length = snprintf(line, sizeof(line), "%s x%u, %u(x%u)", store[random.below(3)], reg(), random.below(64) * 4, reg()); break;
+            
+            // Branches stay within 4 KB; with labels that far apart, jump instead
+            case 4: {
+                int target = i / every + (int)random.below(2 * span + 1) - span;
+                if (target < 0) target = 0;
+                if (target >= labels) target = labels - 1;
+                if (span == 0 || random.below(8) == 0) {
+                    length = snprintf(line, sizeof(line), "jal x%u, L%d", reg(), target);
+                } else {
+                    length = snprintf(line, sizeof(line), "%s x%u, x%u, L%d", branch[random.below(6)], reg(), reg(), target);
+                }
+            } break;
+            
+            case 5: {
+                switch (random.below(4)) {
+                    case 0: length = snprintf(line, sizeof(line), "fadd.s f%u, f%u, f%u", reg(), reg(), reg()); break;
+                    case 1: length = snprintf(line, sizeof(line), "fsub.s f%u, f%u, f%u", reg(), reg(), reg()); break;
+                    case 2: length = snprintf(line, sizeof(line), "flw f%u, %u(x%u)", reg(), random.below(64) * 4, reg()); break;
+                    default: length = snprintf(line, sizeof(line), "fsw f%u, %u(x%u)", reg(), random.below(64) * 4, reg()); break;
+                }
+            } break;
+        }
+        
+        source.append(line, length);
+        if ((int)random.below(100) < options.commentPercent) {
+            source += ' ';
+            source += comments[random.below(4)];
+        }
+        source += '\n';
+    }
+    
+    return source;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+//
+// Synthetic corpora for the benchmarks
+// The generator only uses its own seeded LCG, so the same options always
+// give the same source, on any machine and at any commit.
+//
+// The mix weights are relative: a 30/30/10/10/15/5 mix gives 30% R-Type,
+// 30% I-Type, and so on. Branches and jumps go to labels near the current
+// line, in both directions, so a corpus needs a label once in a while.
+//
+struct CorpusMix {
+    int rtype = 30;
+    int itype = 30;
+    int load = 10;
+    int store = 10;
+    int branch = 15;
+    int fp = 5;
+};
+
+struct CorpusOptions {
+    int lines = 100000;
+    CorpusMix mix;
+    int labelEvery = 16;        // One label line per this many lines
+    int commentPercent = 10;    // Instructions with a trailing comment
+    uint32_t seed = 12345;
+};
+
+bool parseNumber(const std::string &text, long long min, long long max, long long &value);
+bool parseMix(std::string text, CorpusMix &mix);
+std::string generateCorpus(const CorpusOptions &options);
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "lex.hpp"
+#include "symtab.hpp"
+#include "pass1.hpp"
+#include "pass2.hpp"
+
+//
+// A tiny deterministic generator so runs can be compared
+//
+static uint32_t seed = 12345;
+
+static uint32_t next() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static std::string reg() {
+    return "x" + std::to_string(next() % 32);
+}
+
+//
+// Builds a synthetic source with a mix of instructions
+//
+static std::string generate(int lines) {
+    static const char *rtype[] = { "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and" };
+    static const char *itype[] = { "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai" };
+    static const char *load[] = { "lb", "lh", "lw", "lbu", "lhu" };
+    static const char *store[] = { "sb", "sh", "sw" };
+    static const char *branch[] = { "beq", "bne", "blt", "bge", "bltu", "bgeu" };
+    
+    std::ostringstream writer;
+    for (int i = 0; i<lines; i++) {
+        if (i % 16 == 0) {
+            writer << "L" << i << ":\n";
+            continue;
+        }
+        
+        switch (next() % 6) {
+            case 0: writer << rtype[next() % 10] << " " << reg() << ", " << reg() << ", " << reg() << "\n"; break;
+            case 1: writer << itype[next() % 9] << " " << reg() << ", " << reg() << ", " << (next() % 31) << "\n"; break;
+            case 2: writer << load[next() % 5] << " " << reg() << ", " << (next() % 64) << "(" << reg() << ")\n"; break;
+            case 3: writer << store[next() % 3] << " " << reg() << ", " << (next() % 64) << "(" << reg() << ")\n"; break;
+            case 4: writer << branch[next() % 6] << " " << reg() << ", " << reg() << ", L" << (i & ~15) << "\n"; break;
+            case 5: writer << "fadd.s f" << (next() % 32) << ", f" << (next() % 32) << ", f" << (next() % 32) << "\n"; break;
+        }
+    }
+    return writer.str();
+}
+
+//
+// Times parsing and encoding separately over the same token buffer
+//
+int main(int argc, char **argv) {
+    int lines = 1000000;
+    if (argc > 1) lines = std::stoi(argv[1]);
+    
+    std::string source = generate(lines);
+    
+    SymbolTable *symbols = new SymbolTable;
+    Lex *lex = new Lex(source.data(), source.length());
+    lex->setSymbols(symbols);
+    std::vector<Token> tokens = lex->tokenize();
+    
+    Lex *lex1 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass1 *pass1 = new Pass1(lex1, symbols);
+    int size = pass1->run();
+    
+    Lex *lex2 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass2 *pass2 = new Pass2(lex2, symbols);
+    pass2->reserve(size);
+    
+    auto start = std::chrono::steady_clock::now();
+    pass2->parse(SIZE_MAX);
+    auto parsed = std::chrono::steady_clock::now();
+    pass2->encode();
+    auto end = std::chrono::steady_clock::now();
+    
+    double parseSecs = std::chrono::duration<double>(parsed - start).count();
+    double encodeSecs = std::chrono::duration<double>(end - parsed).count();
+    size_t count = pass2->getProgram().size();
+    
+    std::cout << "lines:          " << lines << std::endl;
+    std::cout << "entries:        " << count << std::endl;
+    std::cout << "parse seconds:  " << parseSecs << std::endl;
+    std::cout << "parse/sec:      " << (uint64_t)(count / parseSecs) << std::endl;
+    std::cout << "encode seconds: " << encodeSecs << std::endl;
+    std::cout << "encode/sec:     " << (uint64_t)(count / encodeSecs) << std::endl;
+    
+    delete pass2;
+    delete lex2;
+    delete pass1;
+    delete lex1;
+    delete lex;
+    delete symbols;
+    return 0;
+}
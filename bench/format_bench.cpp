@@ -0,0 +1,49 @@
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include "output.hpp"
+
+//
+// Writes a large image in every output format and reports MB/s of image
+// consumed and of text produced
+//
+int main(int argc, char **argv) {
+    size_t words = 16 << 20;
+    if (argc > 1) words = std::stoul(argv[1]) << 20;
+    
+    Image image;
+    image.bytes.resize(words * sizeof(uint32_t));
+    uint32_t seed = 12345;
+    for (size_t i = 0; i<words; i++) {
+        seed = seed * 1103515245 + 12345;
+        memcpy(&image.bytes[i * sizeof(uint32_t)], &seed, sizeof(uint32_t));
+    }
+    
+    const char *names[] = { "default", "string", "hex", "readmemh", "readmemb", "coe" };
+    for (const char *name : names) {
+        Format format;
+        getFormat(name, format);
+        
+        FILE *file = fopen("/dev/null", "wb");
+        auto start = std::chrono::steady_clock::now();
+        
+        Sink *sink = new Sink(file);
+        writeImage(image, format, *sink);
+        sink->flush();
+        size_t produced = sink->size();
+        delete sink;
+        
+        auto end = std::chrono::steady_clock::now();
+        fclose(file);
+        
+        double secs = std::chrono::duration<double>(end - start).count();
+        double in = image.bytes.size() / secs / 1e6;
+        double out = produced / secs / 1e6;
+        std::cout << name << ": " << in << " MB/s in, " << out << " MB/s out" << std::endl;
+    }
+    
+    return 0;
+}
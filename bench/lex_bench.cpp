@@ -0,0 +1,80 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "lex.hpp"
+
+//
+// A tiny deterministic generator so runs can be compared
+//
+static uint32_t seed = 12345;
+
+static uint32_t next() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static std::string reg() {
+    return "x" + std::to_string(next() % 32);
+}
+
+//
+// Writes a synthetic source file with a mix of instructions
+//
+static void generate(std::string path, int lines) {
+    static const char *rtype[] = { "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and" };
+    static const char *itype[] = { "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai" };
+    static const char *load[] = { "lb", "lh", "lw", "lbu", "lhu" };
+    static const char *store[] = { "sb", "sh", "sw" };
+    static const char *branch[] = { "beq", "bne", "blt", "bge", "bltu", "bgeu" };
+    
+    std::ofstream writer(path);
+    for (int i = 0; i<lines; i++) {
+        if (i % 16 == 0) {
+            writer << "L" << i << ":\n";
+            continue;
+        }
+        
+        switch (next() % 6) {
+            case 0: writer << rtype[next() % 10] << " " << reg() << ", " << reg() << ", " << reg() << "\n"; break;
+            case 1: writer << itype[next() % 9] << " " << reg() << ", " << reg() << ", " << (next() % 31) << "\n"; break;
+            case 2: writer << load[next() % 5] << " " << reg() << ", " << (next() % 64) << "(" << reg() << ")\n"; break;
+            case 3: writer << store[next() % 3] << " " << reg() << ", " << (next() % 64) << "(" << reg() << ")\n"; break;
+            case 4: writer << branch[next() % 6] << " " << reg() << ", " << reg() << ", L" << (i & ~15) << "\n"; break;
+            case 5: writer << "fadd.s f" << (next() % 32) << ", f" << (next() % 32) << ", f" << (next() % 32) << "\n"; break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int lines = 1000000;
+    if (argc > 1) lines = std::stoi(argv[1]);
+    
+    std::string path = "lex_bench.asm";
+    generate(path, lines);
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    Lex *lex = new Lex(path);
+    uint64_t count = 0;
+    Token token = lex->getNext();
+    while (token.type != Eof) {
+        ++count;
+        token = lex->getNext();
+    }
+    delete lex;
+    
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+    
+    std::cout << "lines:      " << lines << std::endl;
+    std::cout << "tokens:     " << count << std::endl;
+    std::cout << "seconds:    " << secs << std::endl;
+    std::cout << "tokens/sec: " << (uint64_t)(count / secs) << std::endl;
+    
+    remove(path.c_str());
+    return 0;
+}
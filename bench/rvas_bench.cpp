@@ -0,0 +1,209 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <climits>
+
+#include "corpus.hpp"
+#include "lex.hpp"
+#include "symtab.hpp"
+#include "pass1.hpp"
+#include "pass2.hpp"
+#include "output.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+//
+// The best time of each phase over the repeats
+//
+struct Timing {
+    double lex = 0;
+    double pass1 = 0;
+    double pass2 = 0;
+    double output = 0;
+    size_t tokens = 0;
+    size_t instructions = 0;
+    bool ok = true;
+};
+
+static void keepBest(double &best, double secs) {
+    if (best == 0 || secs < best) best = secs;
+}
+
+//
+// Assembles the source once, timing each phase on its own
+// Pass 1 and Pass 2 replay the tokens, so neither includes lexing.
+//
+static void runOnce(const std::string &source, Format format, FILE *null, Timing &timing) {
+    std::ostringstream errors;
+    SymbolTable *symbols = new SymbolTable;
+    
+    auto start = Clock::now();
+    Lex *lex = new Lex(source.data(), source.length());
+    lex->setSymbols(symbols);
+    std::vector<Token> tokens = lex->tokenize();
+    keepBest(timing.lex, since(start));
+    
+    start = Clock::now();
+    Lex *lex1 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass1 *pass1 = new Pass1(lex1, symbols);
+    pass1->setErrors(&errors);
+    int size = pass1->run();
+    keepBest(timing.pass1, since(start));
+    
+    start = Clock::now();
+    Lex *lex2 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass2 *pass2 = new Pass2(lex2, symbols);
+    pass2->setErrors(&errors);
+    pass2->reserve(size);
+    pass2->run();
+    keepBest(timing.pass2, since(start));
+    
+    start = Clock::now();
+    Sink *sink = new Sink(null);
+    writeImage(pass2->getImage(), format, *sink);
+    sink->flush();
+    delete sink;
+    keepBest(timing.output, since(start));
+    
+    timing.tokens = tokens.size();
+    timing.instructions = pass2->getImage().bytes.size() / 4;
+    if (!errors.str().empty()) {
+        std::cerr << errors.str();
+        timing.ok = false;
+    }
+    
+    delete pass2;
+    delete lex2;
+    delete pass1;
+    delete lex1;
+    delete lex;
+    delete symbols;
+}
+
+static void report(const char *phase, double secs, int lines, size_t bytes, size_t instructions) {
+    std::cout << "  " << std::left << std::setw(8) << phase << std::right << std::fixed
+              << std::setw(10) << std::setprecision(4) << secs << " s"
+              << std::setw(14) << std::setprecision(0) << lines / secs << " lines/s"
+              << std::setw(10) << std::setprecision(1) << bytes / secs / 1e6 << " MB/s"
+              << std::setw(9) << std::setprecision(2) << secs * 1e9 / instructions << " ns/instr"
+              << std::endl;
+}
+
+static void usage() {
+    std::cerr << "Usage: rvas_bench [options]" << std::endl;
+    std::cerr << "  --lines <n,...>     Corpus sizes (default 10000,100000,1000000)" << std::endl;
+    std::cerr << "  --mix <r,i,l,s,b,f> Weights of R-Type, I-Type, load, store, branch and float instructions" << std::endl;
+    std::cerr << "  --labels <n>        One label every n lines (default 16, 0 for one label)" << std::endl;
+    std::cerr << "  --comments <pct>    Percent of instructions with a trailing comment (default 10)" << std::endl;
+    std::cerr << "  --seed <n>          Generator seed (default 12345)" << std::endl;
+    std::cerr << "  --repeat <n>        Runs per size; the best time of each phase is kept (default 3)" << std::endl;
+    std::cerr << "  -f <format>         Output format (default binary)" << std::endl;
+}
+
+//
+// Generates each corpus, then assembles it phase by phase
+//
+int main(int argc, char **argv) {
+    CorpusOptions options;
+    std::vector<int> sizes = { 10000, 100000, 1000000 };
+    std::string formatName = "default";
+    int repeat = 3;
+    
+    for (int i = 1; i<argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        
+        std::string value = argv[++i];
+        long long number = 0;
+        bool valid = true;
+        if (arg == "--lines") {
+            sizes.clear();
+            std::istringstream reader(value);
+            std::string item;
+            while (valid && std::getline(reader, item, ',')) {
+                valid = parseNumber(item, 1, INT_MAX, number);
+                sizes.push_back((int)number);
+            }
+            valid = valid && !sizes.empty();
+        } else if (arg == "--mix") {
+            valid = parseMix(value, options.mix);
+        } else if (arg == "--labels") {
+            valid = parseNumber(value, 0, INT_MAX, number);
+            options.labelEvery = (int)number;
+        } else if (arg == "--comments") {
+            valid = parseNumber(value, 0, 100, number);
+            options.commentPercent = (int)number;
+        } else if (arg == "--seed") {
+            valid = parseNumber(value, 0, UINT32_MAX, number);
+            options.seed = (uint32_t)number;
+        } else if (arg == "--repeat") {
+            valid = parseNumber(value, 1, INT_MAX, number);
+            repeat = (int)number;
+        } else if (arg == "-f") {
+            formatName = value;
+        } else {
+            usage();
+            return 1;
+        }
+        
+        if (!valid) {
+            std::cerr << "Error: Invalid " << arg.substr(2) << ": " << value << std::endl;
+            return 1;
+        }
+    }
+    
+    Format format;
+    if (!getFormat(formatName, format)) {
+        std::cerr << "Error: Unknown format: " << formatName << std::endl;
+        return 1;
+    }
+    
+    FILE *null = fopen("/dev/null", "wb");
+    if (!null) {
+        std::cerr << "Error: Unable to open /dev/null" << std::endl;
+        return 1;
+    }
+    
+    const CorpusMix &mix = options.mix;
+    std::cout << "mix " << mix.rtype << "," << mix.itype << "," << mix.load << "," << mix.store << ","
+              << mix.branch << "," << mix.fp << ", label every " << options.labelEvery << " lines, "
+              << options.commentPercent << "% comments, seed " << options.seed << ", format " << formatName
+              << ", best of " << repeat << std::endl;
+    
+    int status = 0;
+    for (int lines : sizes) {
+        options.lines = lines;
+        std::string source = generateCorpus(options);
+        
+        Timing timing;
+        for (int i = 0; i<repeat; i++) {
+            runOnce(source, format, null, timing);
+        }
+        if (!timing.ok) status = 1;
+        
+        size_t bytes = source.length();
+        size_t instructions = timing.instructions > 0 ? timing.instructions : 1;
+        std::cout << std::endl << lines << " lines, " << bytes << " bytes, " << timing.tokens << " tokens, "
+                  << timing.instructions << " instructions" << std::endl;
+        report("lex", timing.lex, lines, bytes, instructions);
+        report("pass1", timing.pass1, lines, bytes, instructions);
+        report("pass2", timing.pass2, lines, bytes, instructions);
+        report("output", timing.output, lines, bytes, instructions);
+        report("total", timing.lex + timing.pass1 + timing.pass2 + timing.output, lines, bytes, instructions);
+    }
+    
+    fclose(null);
+    return status;
+}
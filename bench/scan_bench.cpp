@@ -0,0 +1,79 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+#include "lex.hpp"
+#include "scan.hpp"
+
+//
+// Builds a synthetic corpus of roughly the given size
+//
+static std::string generate(std::string kind, size_t size) {
+    std::string source = "";
+    source.reserve(size + 256);
+    
+    int i = 0;
+    while (source.length() < size) {
+        if (kind == "comments") {
+            source += "; generated from node " + std::to_string(i) + " of the dataflow graph, scheduled in cycle 12\n";
+            source += "add x1, x2, x3 ; accumulate the partial sum into the result register\n";
+        } else if (kind == "whitespace") {
+            source += "                add     x1,     x2,     x3\n";
+            source += "                lw      x4,     20(x2)\n";
+            source += "                                                                \n";
+        } else {
+            source += "L" + std::to_string(i) + ":\n";
+            source += "add x1, x2, x3\n";
+            source += "addi x5, x0, 10\n";
+            source += "lw x4, 20(x2)\n";
+            source += "beq x4, x5, L" + std::to_string(i) + "\n";
+        }
+        ++i;
+    }
+    
+    return source;
+}
+
+//
+// Lexes the whole corpus and returns GB/s
+//
+static double run(const std::string &source, ScanLevel level, int rounds) {
+    uint64_t tokens = 0;
+    auto start = std::chrono::steady_clock::now();
+    
+    for (int r = 0; r<rounds; r++) {
+        Lex lex(source.data(), source.length());
+        lex.setScanLevel(level);
+        Token token = lex.getNext();
+        while (token.type != Eof) {
+            ++tokens;
+            token = lex.getNext();
+        }
+    }
+    
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+    if (tokens == 0) std::cerr << "Error: No tokens." << std::endl;
+    return (double)source.length() * rounds / secs / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t size = 64 << 20;
+    if (argc > 1) size = std::stoul(argv[1]) << 20;
+    
+    const char *kinds[] = { "code", "comments", "whitespace" };
+    const char *levels[] = { "scalar", "sse2", "avx2" };
+    ScanLevel best = getBestScanLevel();
+    
+    for (const char *kind : kinds) {
+        std::string source = generate(kind, size);
+        std::cout << kind << " (" << (source.length() >> 20) << " MB)" << std::endl;
+        
+        for (int level = ScanScalar; level <= best; level++) {
+            std::cout << "    " << levels[level] << ": " << run(source, (ScanLevel)level, 3) << " GB/s" << std::endl;
+        }
+    }
+    
+    return 0;
+}
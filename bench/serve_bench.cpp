@@ -0,0 +1,134 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.hpp"
+
+// A small snippet with labels in both directions
+static const std::string snippet =
+    "start:\n"
+    "addi x1, x0, 10\n"
+    "loop:\n"
+    "addi x1, x1, -1\n"
+    "sw x1, 4(x2)\n"
+    "bne x1, x0, loop\n"
+    "jal x0, done\n"
+    "add x3, x1, x2\n"
+    "done:\n"
+    "hlt\n";
+
+static bool readAll(int fd, void *data, size_t length) {
+    char *pos = (char *)data;
+    while (length > 0) {
+        ssize_t count = read(fd, pos, length);
+        if (count <= 0) return false;
+        pos += count;
+        length -= count;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void *data, size_t length) {
+    const char *pos = (const char *)data;
+    while (length > 0) {
+        ssize_t count = write(fd, pos, length);
+        if (count <= 0) return false;
+        pos += count;
+        length -= count;
+    }
+    return true;
+}
+
+static int connectTo(const std::string &path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//
+// Sends the snippet over each connection, one request at a time, and
+// reports assemblies per second over all of them
+//
+// Usage: serve_bench <socket> [connections] [requests per connection]
+//
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: serve_bench <socket> [connections] [requests]" << std::endl;
+        return 1;
+    }
+    std::string path = argv[1];
+    int connections = argc > 2 ? std::stoi(argv[2]) : 8;
+    int requests = argc > 3 ? std::stoi(argv[3]) : 20000;
+    
+    uint8_t length[4];
+    putLength(length, (uint32_t)snippet.length());
+    std::string request((const char *)length, sizeof(length));
+    request += snippet;
+    
+    std::atomic<int> failures(0);
+    std::atomic<uint64_t> imageBytes(0);
+    
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int c = 0; c<connections; c++) {
+        clients.emplace_back([&]() {
+            int fd = connectTo(path);
+            if (fd < 0) {
+                ++failures;
+                return;
+            }
+            
+            std::vector<char> reply;
+            for (int i = 0; i<requests; i++) {
+                uint8_t header[8];
+                if (!writeAll(fd, request.data(), request.length()) || !readAll(fd, header, sizeof(header))) {
+                    ++failures;
+                    break;
+                }
+                
+                uint32_t image = getLength(header);
+                uint32_t errors = getLength(header + 4);
+                reply.resize(image + errors);
+                if (!readAll(fd, reply.data(), reply.size()) || errors != 0) {
+                    ++failures;
+                    break;
+                }
+                imageBytes += image;
+            }
+            close(fd);
+        });
+    }
+    for (std::thread &client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    if (failures != 0) {
+        std::cerr << "Error: " << failures << " connections failed." << std::endl;
+        return 1;
+    }
+    
+    uint64_t total = (uint64_t)connections * requests;
+    std::cout << "connections:    " << connections << std::endl;
+    std::cout << "assemblies:     " << total << std::endl;
+    std::cout << "image bytes:    " << imageBytes << std::endl;
+    std::cout << "seconds:        " << seconds << std::endl;
+    std::cout << "assemblies/sec: " << (uint64_t)(total / seconds) << std::endl;
+    return 0;
+}
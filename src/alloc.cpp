@@ -0,0 +1,57 @@
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include "alloc.hpp"
+
+#ifdef RVAS_STATS
+
+//
+// Counting allocator
+// Replaces the global operator new, so every heap allocation in the
+// process is counted, including those inside the standard library.
+//
+static std::atomic<size_t> allocationCount(0);
+static std::atomic<size_t> allocationBytes(0);
+
+void *operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void getAllocations(size_t &count, size_t &bytes) {
+    count = allocationCount.load(std::memory_order_relaxed);
+    bytes = allocationBytes.load(std::memory_order_relaxed);
+}
+
+#else
+
+void getAllocations(size_t &count, size_t &bytes) {
+    count = 0;
+    bytes = 0;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+
+//
+// Heap allocation counts for --stats
+// With RVAS_STATS, the rvas executable replaces the global operator new
+// and counts every allocation in the process. The library never does, so
+// programs linked against it keep their own allocator.
+//
+void getAllocations(size_t &count, size_t &bytes);
@@ -0,0 +1,392 @@
+#include <sstream>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+#include "assemble.hpp"
+#include "lex.hpp"
+#include "symtab.hpp"
+#include "pass1.hpp"
+#include "pass2.hpp"
+#include "relax.hpp"
+
+// Chunks smaller than this are not worth a thread of their own
+constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+//
+// A run of whole lines of the source
+// Each chunk is lexed and sized with its own symbol table, so chunks can
+// be worked on in parallel; the tables are merged once every chunk is done.
+//
+struct Chunk {
+    std::string_view text;
+    std::vector<Token> tokens;
+    SymbolTable symbols;
+    std::ostringstream errors;
+    bool openString = false;
+    int size = 0;       // Bytes of output
+    int lc = 0;         // Location counter at the start of the chunk
+    int lines = 0;      // Newlines in the chunk
+    int line = 1;       // Line number at the start of the chunk
+    std::vector<Site> sites;
+    Image image;
+};
+
+//
+// Runs work(i) for every i < count, spread over count threads
+//
+template<class Work>
+static void runParallel(size_t count, Work work) {
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i<count; i++) {
+        workers.emplace_back(work, i);
+    }
+    if (count > 0) work(0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+//
+// Splits the source into at most count chunks of about the same size
+// Each chunk ends just after a newline.
+//
+static std::vector<std::string_view> splitLines(std::string_view text, unsigned count) {
+    size_t size = text.length() / count;
+    if (size < MIN_CHUNK_BYTES) size = MIN_CHUNK_BYTES;
+    
+    std::vector<std::string_view> pieces;
+    while (!text.empty()) {
+        size_t stop = text.length();
+        if (size < text.length() && pieces.size() + 1 < count) {
+            stop = text.find('\n', size);
+            stop = stop == std::string_view::npos ? text.length() : stop + 1;
+        }
+        
+        pieces.push_back(text.substr(0, stop));
+        text.remove_prefix(stop);
+    }
+    
+    return pieces;
+}
+
+//
+// Lexes a chunk into its own token buffer and symbol table
+//
+static void lexChunk(Chunk *chunk) {
+    chunk->symbols = SymbolTable();
+    
+    Lex *lex = new Lex(chunk->text.data(), chunk->text.length());
+    lex->setSymbols(&chunk->symbols);
+    chunk->tokens = lex->tokenize();
+    chunk->openString = lex->hasOpenString();
+    chunk->lines = (int)std::count(chunk->text.begin(), chunk->text.end(), '\n');
+    delete lex;
+}
+
+//
+// Runs Pass 1 on a chunk
+// Label and site addresses are relative to the start of the chunk.
+//
+static void sizeChunk(Chunk *chunk) {
+    Lex *lex1 = new Lex(chunk->tokens.data(), chunk->tokens.data() + chunk->tokens.size());
+    Pass1 *pass1 = new Pass1(lex1, &chunk->symbols);
+    pass1->setErrors(&chunk->errors);
+    pass1->setSites(&chunk->sites);
+    chunk->size = pass1->run(0);
+    delete pass1;
+    delete lex1;
+}
+
+//
+// Points the chunk's tokens at the merged symbol table and runs Pass 2
+//
+static void encodeChunk(Chunk *chunk, const std::vector<int> &remap, SymbolTable *symbols, bool relocatable) {
+    for (Token &token : chunk->tokens) {
+        if (token.type == Id) token.sym = remap[token.sym];
+    }
+    
+    Lex *lex = new Lex(chunk->tokens.data(), chunk->tokens.data() + chunk->tokens.size());
+    Pass2 *pass2 = new Pass2(lex, symbols);
+    pass2->setErrors(&chunk->errors);
+    pass2->setRelocatable(relocatable);
+    pass2->setStart(chunk->lc);
+    pass2->setStartLine(chunk->line);
+    pass2->setSites(chunk->sites.data(), chunk->sites.data() + chunk->sites.size());
+    pass2->reserve(chunk->size);
+    pass2->run();
+    
+    chunk->image = std::move(pass2->getImage());
+    delete pass2;
+    delete lex;
+}
+
+//
+// Copies the labels into a relocatable image
+// The image symbols have the same ids as the table, so relocations can
+// refer to them directly.
+//
+static void addSymbols(const SymbolTable *symbols, Image &image) {
+    for (size_t id = 0; id<symbols->size(); id++) {
+        bool defined = symbols->isDefined(id);
+        image.symbols.push_back({ std::string(symbols->getName(id)), defined ? symbols->getAddress(id) : 0, defined });
+    }
+}
+
+//
+// Adds a symbol table's size and lookups to the stats
+//
+static void countSymbols(const SymbolTable *symbols, Stats *stats) {
+    stats->symbols += symbols->size();
+    stats->lookups += symbols->getLookups();
+    stats->probes += symbols->getProbes();
+}
+
+//
+// Counts the instructions of an image: everything outside the strings
+//
+static size_t countInstructions(const Image &image) {
+    size_t data = 0;
+    for (auto range : image.data) {
+        data += range.second;
+    }
+    return (image.bytes.size() - data) / 4;
+}
+
+//
+// Assembles in one pass over the scanner
+//
+static void assembleSinglePass(Lex *lex, bool relocatable, Stats *stats, Assembly &result) {
+    PhaseTimer timer(stats);
+    std::ostringstream errors;
+    SymbolTable *symbols = new SymbolTable;
+    lex->setSymbols(symbols);
+    
+    Pass2 *pass2 = new Pass2(lex, symbols);
+    pass2->setErrors(&errors);
+    pass2->setSinglePass(true);
+    pass2->setRelocatable(relocatable);
+    pass2->run();
+    
+    // Lexing is interleaved with Pass 2, so it is timed with it
+    timer.lap(PhasePass2);
+    
+    result.image = std::move(pass2->getImage());
+    result.errors = errors.str();
+    if (relocatable) addSymbols(symbols, result.image);
+    if (stats) {
+        stats->tokens += pass2->getTokens();
+        countSymbols(symbols, stats);
+    }
+    delete pass2;
+    delete symbols;
+}
+
+//
+// Assembles a source in two passes on the calling thread
+// Small sources take this path, so they pay for one symbol table and
+// no merging or copying of images.
+//
+static void assembleSerial(std::string_view source, bool relocatable, Stats *stats, Assembly &result) {
+    PhaseTimer timer(stats);
+    std::ostringstream errors;
+    SymbolTable *symbols = new SymbolTable;
+    Lex *lex = new Lex(source.data(), source.length());
+    lex->setSymbols(symbols);
+    std::vector<Token> tokens = lex->tokenize();
+    timer.lap(PhaseLex);
+    
+    std::vector<Site> sites;
+    Lex *lex1 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass1 *pass1 = new Pass1(lex1, symbols);
+    pass1->setErrors(&errors);
+    pass1->setSites(&sites);
+    int size = pass1->run();
+    if (relax(sites, symbols)) size = relaxedAddress(sites, size);
+    timer.lap(PhasePass1);
+    
+    Lex *lex2 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass2 *pass2 = new Pass2(lex2, symbols);
+    pass2->setErrors(&errors);
+    pass2->setRelocatable(relocatable);
+    pass2->setSites(sites.data(), sites.data() + sites.size());
+    pass2->reserve(size);
+    pass2->run();
+    timer.lap(PhasePass2);
+    
+    result.image = std::move(pass2->getImage());
+    result.errors = errors.str();
+    if (relocatable) addSymbols(symbols, result.image);
+    if (stats) {
+        stats->tokens += tokens.size();
+        countSymbols(symbols, stats);
+    }
+    delete pass2;
+    delete lex2;
+    delete pass1;
+    delete lex1;
+    delete lex;
+    delete symbols;
+}
+
+//
+// Assembles a source held in memory
+// The source is split into chunks of whole lines, which are lexed, sized
+// and encoded on up to options.jobs threads. The output is the same for
+// any number of jobs.
+//
+Assembly assemble(std::string_view source, const AssembleOptions &options) {
+    Assembly result;
+    Stats *stats = options.stats;
+    if (stats) stats->bytesIn += source.length();
+    if (options.singlePass) {
+        Lex *lex = new Lex(source.data(), source.length());
+        assembleSinglePass(lex, options.relocatable, stats, result);
+        delete lex;
+        if (stats) stats->instructions += countInstructions(result.image);
+        return result;
+    }
+    
+    unsigned jobs = options.jobs == 0 ? 1 : options.jobs;
+    std::vector<std::string_view> pieces = splitLines(source, jobs);
+    if (pieces.size() <= 1) {
+        assembleSerial(source, options.relocatable, stats, result);
+        if (stats) stats->instructions += countInstructions(result.image);
+        return result;
+    }
+    
+    PhaseTimer timer(stats);
+    
+    std::vector<Chunk> chunks(pieces.size());
+    for (size_t i = 0; i<pieces.size(); i++) {
+        chunks[i].text = pieces[i];
+    }
+    
+    // Lex every chunk at once
+    runParallel(chunks.size(), [&](size_t i) {
+        lexChunk(&chunks[i]);
+    });
+    
+    // A split can land inside a string that spans lines; the chunk before
+    // it then ends in an open string. Join the two and lex them again.
+    for (size_t i = 0; i + 1<chunks.size(); i++) {
+        if (!chunks[i].openString) continue;
+        
+        std::string_view next = chunks[i + 1].text;
+        chunks[i].text = std::string_view(chunks[i].text.data(), chunks[i].text.length() + next.length());
+        chunks.erase(chunks.begin() + i + 1);
+        
+        lexChunk(&chunks[i]);
+        --i;
+    }
+    timer.lap(PhaseLex);
+    
+    // Size every chunk at once
+    runParallel(chunks.size(), [&](size_t i) {
+        sizeChunk(&chunks[i]);
+    });
+    
+    // A prefix sum over the chunk sizes turns local addresses into global
+    // ones. The local tables are then merged in source order, so a label
+    // defined twice keeps its last address, as in a serial run.
+    SymbolTable *symbols = new SymbolTable;
+    std::vector<std::vector<int>> remaps(chunks.size());
+    int lc = 0;
+    int line = 1;
+    for (size_t i = 0; i<chunks.size(); i++) {
+        Chunk &chunk = chunks[i];
+        chunk.lc = lc;
+        chunk.line = line;
+        lc += chunk.size;
+        line += chunk.lines;
+        
+        remaps[i].resize(chunk.symbols.size());
+        for (size_t id = 0; id<chunk.symbols.size(); id++) {
+            int sym = symbols->intern(chunk.symbols.getName(id));
+            remaps[i][id] = sym;
+            if (chunk.symbols.isDefined(id)) {
+                symbols->define(sym, chunk.lc + chunk.symbols.getAddress(id));
+            }
+        }
+    }
+    
+    // Relaxation needs every site at once, since a long jump in one chunk
+    // moves the labels of the others
+    std::vector<Site> sites;
+    for (size_t i = 0; i<chunks.size(); i++) {
+        for (const Site &site : chunks[i].sites) {
+            int at = chunks[i].lc + site.lc;
+            sites.push_back({ at, remaps[i][site.sym], site.kind, site.size, at });
+        }
+    }
+    if (relax(sites, symbols)) {
+        for (Chunk &chunk : chunks) {
+            int end = relaxedAddress(sites, chunk.lc + chunk.size);
+            chunk.lc = relaxedAddress(sites, chunk.lc);
+            chunk.size = end - chunk.lc;
+        }
+        lc = relaxedAddress(sites, lc);
+    }
+    
+    size_t next = 0;
+    for (Chunk &chunk : chunks) {
+        for (Site &site : chunk.sites) {
+            site = sites[next++];
+        }
+    }
+    
+    timer.lap(PhasePass1);
+    
+    // Pass 2 encodes each chunk on its own thread
+    runParallel(chunks.size(), [&](size_t i) {
+        encodeChunk(&chunks[i], remaps[i], symbols, options.relocatable);
+    });
+    
+    result.image.bytes.reserve(lc);
+    for (Chunk &chunk : chunks) {
+        result.image.append(chunk.image);
+        result.errors += chunk.errors.str();
+    }
+    if (options.relocatable) addSymbols(symbols, result.image);
+    timer.lap(PhasePass2);
+    
+    // The chunk tables are counted for their lookups; every label in them
+    // is also in the merged table
+    if (stats) {
+        for (Chunk &chunk : chunks) {
+            stats->tokens += chunk.tokens.size();
+            stats->lookups += chunk.symbols.getLookups();
+            stats->probes += chunk.symbols.getProbes();
+        }
+        countSymbols(symbols, stats);
+        stats->instructions += countInstructions(result.image);
+    }
+    
+    delete symbols;
+    return result;
+}
+
+//
+// Assembles a stream in a single pass
+// Only the current line, the image and the unresolved forward references
+// are held in memory.
+//
+Assembly assemble(std::istream *stream, const AssembleOptions &options) {
+    Assembly result;
+    Lex *lex = new Lex(stream);
+    assembleSinglePass(lex, options.relocatable, options.stats, result);
+    delete lex;
+    if (options.stats) options.stats->instructions += countInstructions(result.image);
+    return result;
+}
+
+//
+// The image as little-endian words; a trailing partial word is zero-padded
+//
+std::vector<uint32_t> Assembly::words() const {
+    std::vector<uint32_t> words((image.bytes.size() + 3) / 4, 0);
+    if (!image.bytes.empty()) {
+        memcpy(words.data(), image.bytes.data(), image.bytes.size());
+    }
+    return words;
+}
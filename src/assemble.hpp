@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <istream>
+
+#include "output.hpp"
+#include "stats.hpp"
+
+//
+// The assembler library
+// assemble() keeps all of its state in the call, and diagnostics are
+// returned rather than printed, so any number of threads can assemble at
+// once. Reading and writing files is left to the caller.
+//
+struct AssembleOptions {
+    bool singlePass = false;    // Patch forward references instead of running Pass 1
+    unsigned jobs = 1;          // Threads for large sources
+    bool relocatable = false;   // Leave addresses and undefined labels to a linker
+    Stats *stats = nullptr;     // Phase times and counts, if wanted
+};
+
+struct Assembly {
+    Image image;
+    std::string errors;         // Diagnostics, one per line
+    
+    bool ok() const { return errors.empty(); }
+    std::vector<uint32_t> words() const;
+};
+
+Assembly assemble(std::string_view source, const AssembleOptions &options = AssembleOptions());
+Assembly assemble(std::istream *stream, const AssembleOptions &options = AssembleOptions());
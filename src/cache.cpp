@@ -0,0 +1,521 @@
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.hpp"
+#include "lex.hpp"
+#include "symtab.hpp"
+#include "pass1.hpp"
+#include "pass2.hpp"
+#include "output.hpp"
+#include "pool.hpp"
+#include "relax.hpp"
+#include "assemble.hpp"
+
+// Lines per region; a region only ends outside a string
+constexpr int REGION_LINES = 1024;
+
+// Bump when the layout of the cache file changes
+constexpr char CACHE_MAGIC[8] = { 'R', 'V', 'A', 'S', 'C', 'A', '0', '1' };
+
+//
+// A label and its address
+// Addresses of region labels are relative to the start of the region.
+//
+struct Label {
+    std::string name;
+    int address;
+};
+
+//
+// What the cache knows about a region
+//
+struct CachedRegion {
+    uint64_t hash = 0;
+    uint32_t length = 0;
+    int lines = 0;
+    int size = 0;
+    bool hasErrors = false;
+    std::vector<Label> labels;
+    std::vector<std::string> refs;      // Every name the region mentions
+};
+
+struct Cache {
+    std::string output;
+    uint64_t outputSize = 0;
+    int64_t outputTime = 0;
+    std::vector<Label> symbols;
+    std::vector<CachedRegion> regions;
+};
+
+//
+// A region of the current source
+//
+struct Region {
+    std::string_view text;
+    CachedRegion info;
+    int line = 1;
+    int lc = 0;
+    bool lexed = false;
+    bool encode = false;
+    
+    std::vector<Token> tokens;
+    SymbolTable symbols;
+    std::vector<Site> sites;
+    std::ostringstream errors;
+    Image image;
+};
+
+//
+// FNV-1a over the region text
+//
+static uint64_t hashText(std::string_view text) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char c : text) {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+//
+// Splits the source into regions of about REGION_LINES lines
+// A region never ends inside a string, so each one can be lexed alone.
+//
+static std::vector<std::string_view> splitRegions(std::string_view text) {
+    std::vector<std::string_view> regions;
+    size_t start = 0;
+    int lines = 0;
+    bool inString = false;
+    bool inComment = false;
+    
+    for (size_t i = 0; i<text.length(); i++) {
+        char c = text[i];
+        if (inString) {
+            if (c == '\"') inString = false;
+        } else if (c == '\n') {
+            inComment = false;
+            if (++lines >= REGION_LINES) {
+                regions.push_back(text.substr(start, i + 1 - start));
+                start = i + 1;
+                lines = 0;
+            }
+        } else if (inComment) {
+            continue;
+        } else if (c == ';') {
+            inComment = true;
+        } else if (c == '\"') {
+            inString = true;
+        }
+    }
+    
+    if (start < text.length()) regions.push_back(text.substr(start));
+    return regions;
+}
+
+//
+// Cache file helpers
+// Integers are stored in host byte order; strings are length-prefixed.
+//
+template<class T>
+static void put(std::string &out, T value) {
+    out.append((const char *)&value, sizeof(T));
+}
+
+static void putString(std::string &out, const std::string &value) {
+    put<uint32_t>(out, (uint32_t)value.length());
+    out += value;
+}
+
+struct Reader {
+    const char *pos;
+    const char *end;
+    bool ok = true;
+    
+    template<class T>
+    T get() {
+        T value = T();
+        if ((size_t)(end - pos) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    
+    std::string getString() {
+        uint32_t length = get<uint32_t>();
+        if ((size_t)(end - pos) < length) {
+            ok = false;
+            return "";
+        }
+        std::string value(pos, length);
+        pos += length;
+        return value;
+    }
+    
+    void getLabels(std::vector<Label> &labels) {
+        uint32_t count = get<uint32_t>();
+        for (uint32_t i = 0; i<count && ok; i++) {
+            std::string name = getString();
+            labels.push_back({ name, get<int32_t>() });
+        }
+    }
+};
+
+static void putLabels(std::string &out, const std::vector<Label> &labels) {
+    put<uint32_t>(out, (uint32_t)labels.size());
+    for (const Label &label : labels) {
+        putString(out, label.name);
+        put<int32_t>(out, label.address);
+    }
+}
+
+static bool loadCache(const std::string &path, Cache &cache) {
+    std::ifstream reader(path, std::ios::binary);
+    if (!reader.is_open()) return false;
+    std::string data((std::istreambuf_iterator<char>(reader)), std::istreambuf_iterator<char>());
+    
+    if (data.length() < sizeof(CACHE_MAGIC) || memcmp(data.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) {
+        return false;
+    }
+    
+    Reader in = { data.data() + sizeof(CACHE_MAGIC), data.data() + data.length() };
+    cache.output = in.getString();
+    cache.outputSize = in.get<uint64_t>();
+    cache.outputTime = in.get<int64_t>();
+    in.getLabels(cache.symbols);
+    
+    uint32_t count = in.get<uint32_t>();
+    for (uint32_t i = 0; i<count && in.ok; i++) {
+        CachedRegion region;
+        region.hash = in.get<uint64_t>();
+        region.length = in.get<uint32_t>();
+        region.lines = in.get<int32_t>();
+        region.size = in.get<int32_t>();
+        region.hasErrors = in.get<uint8_t>() != 0;
+        in.getLabels(region.labels);
+        
+        uint32_t refs = in.get<uint32_t>();
+        for (uint32_t r = 0; r<refs && in.ok; r++) {
+            region.refs.push_back(in.getString());
+        }
+        cache.regions.push_back(std::move(region));
+    }
+    
+    return in.ok;
+}
+
+static bool saveCache(const std::string &path, const Cache &cache) {
+    std::string out(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    putString(out, cache.output);
+    put<uint64_t>(out, cache.outputSize);
+    put<int64_t>(out, cache.outputTime);
+    putLabels(out, cache.symbols);
+    
+    put<uint32_t>(out, (uint32_t)cache.regions.size());
+    for (const CachedRegion &region : cache.regions) {
+        put<uint64_t>(out, region.hash);
+        put<uint32_t>(out, region.length);
+        put<int32_t>(out, region.lines);
+        put<int32_t>(out, region.size);
+        put<uint8_t>(out, region.hasErrors);
+        putLabels(out, region.labels);
+        
+        put<uint32_t>(out, (uint32_t)region.refs.size());
+        for (const std::string &ref : region.refs) {
+            putString(out, ref);
+        }
+    }
+    
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    fwrite(out.data(), 1, out.length(), file);
+    fclose(file);
+    return true;
+}
+
+//
+// Reads the size and modification time of a file
+//
+static bool statFile(const std::string &path, uint64_t &size, int64_t &time) {
+    struct stat info;
+    if (stat(path.c_str(), &info) == -1) return false;
+    size = info.st_size;
+    time = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+//
+// Lexes and sizes a region, and records its labels and references
+//
+static void lexRegion(Region *region, bool size) {
+    region->symbols = SymbolTable();
+    region->sites.clear();
+    
+    Lex *lex = new Lex(region->text.data(), region->text.length());
+    lex->setSymbols(&region->symbols);
+    region->tokens = lex->tokenize();
+    delete lex;
+    region->lexed = true;
+    if (!size) return;
+    
+    Lex *lex1 = new Lex(region->tokens.data(), region->tokens.data() + region->tokens.size());
+    Pass1 *pass1 = new Pass1(lex1, &region->symbols);
+    pass1->setErrors(&region->errors);
+    pass1->setSites(&region->sites);
+    region->info.size = pass1->run(0);
+    delete pass1;
+    delete lex1;
+    
+    region->info.labels.clear();
+    region->info.refs.clear();
+    for (size_t id = 0; id<region->symbols.size(); id++) {
+        std::string name(region->symbols.getName(id));
+        if (region->symbols.isDefined(id)) {
+            region->info.labels.push_back({ name, region->symbols.getAddress(id) });
+        }
+        region->info.refs.push_back(name);
+    }
+}
+
+//
+// Points the region's tokens at the merged symbol table and runs Pass 2
+//
+static void encodeRegion(Region *region, SymbolTable *symbols) {
+    for (Token &token : region->tokens) {
+        if (token.type == Id) {
+            token.sym = symbols->find(region->symbols.getName(token.sym));
+        }
+    }
+    
+    Lex *lex = new Lex(region->tokens.data(), region->tokens.data() + region->tokens.size());
+    Pass2 *pass2 = new Pass2(lex, symbols);
+    pass2->setErrors(&region->errors);
+    pass2->setStart(region->lc);
+    pass2->setStartLine(region->line);
+    pass2->reserve(region->info.size);
+    pass2->run();
+    
+    region->image = std::move(pass2->getImage());
+    delete pass2;
+    delete lex;
+}
+
+//
+// True if a label has a different address, or is defined in only one of
+// the tables
+//
+static bool labelMoved(const std::string &name, const SymbolTable &now, const SymbolTable &before) {
+    int a = now.find(name);
+    int b = before.find(name);
+    bool definedNow = a != -1 && now.isDefined(a);
+    bool definedBefore = b != -1 && before.isDefined(b);
+    if (definedNow != definedBefore) return true;
+    return definedNow && now.getAddress(a) != before.getAddress(b);
+}
+
+//
+// Assembles the source into output, reusing the cache where it can
+// Returns false if the output could not be written.
+//
+bool assembleCached(std::string_view source, const std::string &output, const std::string &cachePath,
+                    unsigned jobs, std::ostream &errors, CacheStats &stats) {
+    std::vector<std::string_view> pieces = splitRegions(source);
+    std::vector<Region> regions(pieces.size());
+    for (size_t i = 0; i<pieces.size(); i++) {
+        Region &region = regions[i];
+        region.text = pieces[i];
+        region.info.hash = hashText(region.text);
+        region.info.length = (uint32_t)region.text.length();
+        region.info.lines = (int)std::count(region.text.begin(), region.text.end(), '\n');
+    }
+    stats.regions = regions.size();
+    
+    // The output can only be patched if it is the one the cache describes
+    Cache cache;
+    uint64_t outputSize = 0;
+    int64_t outputTime = 0;
+    bool incremental = loadCache(cachePath, cache) && cache.output == output
+        && cache.regions.size() == regions.size()
+        && statFile(output, outputSize, outputTime)
+        && outputSize == cache.outputSize && outputTime == cache.outputTime;
+    
+    // Regions whose text is unchanged and had no errors keep their cached
+    // size and labels; the others are lexed and sized again
+    for (size_t i = 0; i<regions.size(); i++) {
+        Region &region = regions[i];
+        if (incremental) {
+            const CachedRegion &cached = cache.regions[i];
+            if (cached.hash == region.info.hash && cached.length == region.info.length && !cached.hasErrors) {
+                region.info = cached;
+                continue;
+            }
+        }
+        region.encode = true;
+    }
+    
+    WorkPool *pool = new WorkPool(jobs);
+    pool->run(regions.size(), [&](size_t i) {
+        if (regions[i].encode) lexRegion(&regions[i], true);
+    });
+    
+    // Lay the regions out and merge their labels in source order
+    SymbolTable *symbols = new SymbolTable;
+    int lc = 0;
+    int line = 1;
+    for (size_t i = 0; i<regions.size(); i++) {
+        Region &region = regions[i];
+        if (incremental && region.info.size != cache.regions[i].size) incremental = false;
+        
+        region.lc = lc;
+        region.line = line;
+        lc += region.info.size;
+        line += region.info.lines;
+        
+        for (const Label &label : region.info.labels) {
+            symbols->define(symbols->intern(label.name), region.lc + label.address);
+        }
+    }
+    
+    // With the same layout, a region is encoded again if its text changed
+    // or a label it mentions moved
+    if (incremental) {
+        SymbolTable *before = new SymbolTable;
+        for (const Label &label : cache.symbols) {
+            before->define(before->intern(label.name), label.address);
+        }
+        
+        for (Region &region : regions) {
+            if (region.encode) continue;
+            for (const std::string &ref : region.info.refs) {
+                if (labelMoved(ref, *symbols, *before)) {
+                    region.encode = true;
+                    break;
+                }
+            }
+        }
+        delete before;
+    } else {
+        for (Region &region : regions) region.encode = true;
+    }
+    
+    // Regions to encode are sized too, for their branches and jumps
+    pool->run(regions.size(), [&](size_t i) {
+        Region &region = regions[i];
+        if (!region.encode) return;
+        if (!region.lexed) lexRegion(&region, true);
+    });
+    
+    // Interning into the shared table is not thread-safe, so every name is
+    // interned up front; encoding then only reads the table
+    for (Region &region : regions) {
+        if (!region.encode) continue;
+        for (size_t id = 0; id<region.symbols.size(); id++) {
+            symbols->intern(region.symbols.getName(id));
+        }
+    }
+    
+    // A branch or jump out of reach would be relaxed, which moves code
+    // from region to region; such a source is assembled in full and not
+    // cached. A region that is not encoded reaches what it did last time,
+    // since nothing it refers to moved.
+    std::vector<Site> sites;
+    for (Region &region : regions) {
+        if (!region.encode) continue;
+        for (const Site &site : region.sites) {
+            int at = region.lc + site.lc;
+            sites.push_back({ at, symbols->find(region.symbols.getName(site.sym)), site.kind, site.size, at });
+        }
+    }
+    if (relax(sites, symbols)) {
+        delete pool;
+        delete symbols;
+        
+        AssembleOptions options;
+        options.jobs = jobs;
+        Assembly result = assemble(source, options);
+        errors << result.errors;
+        stats.encoded = regions.size();
+        stats.incremental = false;
+        unlink(cachePath.c_str());
+        if (!result.ok()) return false;
+        
+        WriteResult write = writeOutput(result.image, FormatBinary, output);
+        reportWrite(write, output, errors);
+        return write == WriteOk;
+    }
+    
+    pool->run(regions.size(), [&](size_t i) {
+        if (regions[i].encode) encodeRegion(&regions[i], symbols);
+    });
+    delete pool;
+    
+    bool failed = false;
+    for (Region &region : regions) {
+        if (!region.encode) continue;
+        ++stats.encoded;
+        std::string text = region.errors.str();
+        region.info.hasErrors = !text.empty();
+        failed |= region.info.hasErrors;
+        errors << text;
+    }
+    stats.incremental = incremental;
+    
+    // An image with errors in it is not written. The output and the cache
+    // are left as they were, so they still describe each other.
+    if (failed) {
+        delete symbols;
+        return false;
+    }
+    
+    WriteResult write = WriteOk;
+    if (incremental) {
+        int fd = open(output.c_str(), O_WRONLY);
+        if (fd == -1) write = WriteOpenFailed;
+        for (Region &region : regions) {
+            if (write != WriteOk || !region.encode) continue;
+            const std::vector<uint8_t> &bytes = region.image.bytes;
+            if (pwrite(fd, bytes.data(), bytes.size(), region.lc) != (ssize_t)bytes.size()) write = WriteFailed;
+        }
+        if (fd != -1 && close(fd) == -1) write = WriteFailed;
+    } else {
+        Image image;
+        image.bytes.reserve(lc);
+        for (Region &region : regions) {
+            image.append(region.image);
+        }
+        write = writeOutput(image, FormatBinary, output);
+    }
+    reportWrite(write, output, errors);
+    bool written = write == WriteOk;
+    
+    // Record the new state; without a readable output there is nothing to
+    // patch next time, so the cache is left as it is
+    if (written && statFile(output, outputSize, outputTime)) {
+        Cache next;
+        next.output = output;
+        next.outputSize = outputSize;
+        next.outputTime = outputTime;
+        for (size_t id = 0; id<symbols->size(); id++) {
+            if (symbols->isDefined(id)) {
+                next.symbols.push_back({ std::string(symbols->getName(id)), symbols->getAddress(id) });
+            }
+        }
+        for (Region &region : regions) {
+            next.regions.push_back(std::move(region.info));
+        }
+        saveCache(cachePath, next);
+    }
+    
+    delete symbols;
+    return written;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <ostream>
+
+//
+// Incremental reassembly
+// The source is split into regions of whole lines. The cache file records
+// each region's content hash, size, labels and label references, and the
+// address of every label. If a re-run finds every region the same size
+// as before, only regions whose text changed or whose labels moved are
+// encoded again, and their bytes are patched into the existing output.
+// Otherwise the whole source is assembled and the cache rebuilt.
+//
+// A source whose branches or jumps need relaxing is assembled in full
+// every time, and leaves no cache behind.
+//
+// The output file holds the encoded words; the cache only records its
+// size and modification time, so an output changed by anything else is
+// never patched.
+//
+// Diagnostics, including a failure to write the output, go to errors.
+// Returns false if the output was not written.
+//
+struct CacheStats {
+    size_t regions = 0;
+    size_t encoded = 0;         // Regions encoded this run
+    bool incremental = false;   // The output was patched in place
+};
+
+bool assembleCached(std::string_view source, const std::string &output, const std::string &cachePath,
+                    unsigned jobs, std::ostream &errors, CacheStats &stats);
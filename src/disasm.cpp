@@ -0,0 +1,473 @@
+#include <cstring>
+#include <vector>
+#include <iterator>
+
+#include "disasm.hpp"
+#include "isa.hpp"
+#include "pool.hpp"
+
+// Images are decoded in chunks of this many words, so large images keep
+// every thread busy
+constexpr size_t CHUNK_WORDS = 1 << 16;
+
+// Room for the longest line a word can produce
+constexpr size_t MAX_LINE = 96;
+
+//
+// How the operands of an instruction are written
+//
+enum Syntax : uint8_t {
+    SynFixed,           // nop
+    SynR,               // add x1, x2, x3
+    SynFloatR,          // fadd.s f1, f2, f3
+    SynI,               // addi x1, x2, -4
+    SynShift,           // slli x1, x2, 3
+    SynLoad,            // lw x1, 8(x2)
+    SynFloatLoad,       // flw f1, 8(x2)
+    SynStore,           // sw x1, 8(x2)
+    SynFloatStore,      // fsw f1, 8(x2)
+    SynBranch,          // beq x1, x2, L00000010
+    SynU,               // lui x1, 74565
+    SynJal              // jal x1, L00000010
+};
+
+constexpr Syntax getSyntax(const InstrInfo &info) {
+    switch (info.format) {
+        case RType: return info.opcode == 0b1010011 ? SynFloatR : SynR;
+        case IType: {
+            if (info.opcode == 0b0000011) return SynLoad;
+            if (info.opcode == 0b0000111) return SynFloatLoad;
+            return SynI;
+        }
+        case ShiftType: return SynShift;
+        case SType: return info.opcode == 0b0100111 ? SynFloatStore : SynStore;
+        case BType: return SynBranch;
+        case UType: return SynU;
+        case JType: return SynJal;
+        default: {}
+    }
+    return SynFixed;
+}
+
+constexpr uint8_t NO_ROW = 0xFF;
+constexpr size_t ROW_COUNT = std::size(instrRows);
+
+//
+// The decode table
+// Each slot holds the rows of the instruction table that share an opcode
+// and func3. U-Type and J-Type instructions have no func3, so they fill
+// all eight of their slots. The rows in a slot differ in func7, or are
+// fixed words compared whole.
+//
+struct DecodeSlot {
+    uint8_t rows[2] = { NO_ROW, NO_ROW };
+};
+
+struct DecodeTable {
+    DecodeSlot slots[1024] = {};        // opcode | func3 << 7
+    Syntax syntax[ROW_COUNT] = {};
+    char name[ROW_COUNT][8] = {};       // Padded, so it copies in one move
+    uint8_t length[ROW_COUNT] = {};
+    bool fits = true;
+    
+    constexpr DecodeTable() {
+        for (size_t i = 0; i<ROW_COUNT; i++) {
+            const InstrInfo &info = instrRows[i].info;
+            syntax[i] = getSyntax(info);
+            while (instrRows[i].name[length[i]]) {
+                if (length[i] < 8) name[i][length[i]] = instrRows[i].name[length[i]];
+                ++length[i];
+            }
+            if (length[i] > 8) fits = false;
+            
+            bool anyFunc3 = info.format == UType || info.format == JType;
+            for (int func3 = 0; func3<8; func3++) {
+                if (!anyFunc3 && func3 != info.func3) continue;
+                
+                DecodeSlot &slot = slots[info.opcode | func3 << 7];
+                if (slot.rows[0] == NO_ROW) slot.rows[0] = (uint8_t)i;
+                else if (slot.rows[1] == NO_ROW) slot.rows[1] = (uint8_t)i;
+                else fits = false;
+            }
+        }
+    }
+};
+
+static constexpr DecodeTable decodeTable;
+static_assert(decodeTable.fits, "More than two instructions share a decode slot, or a name is too long.");
+static_assert(ROW_COUNT < NO_ROW, "The instruction table has too many rows for the decode table.");
+
+//
+// Returns the row of the instruction table a word decodes to, or -1
+//
+static inline int decodeRow(uint32_t word) {
+    const DecodeSlot &slot = decodeTable.slots[(word & 0x7F) | (word >> 5 & 0x380)];
+    for (uint8_t row : slot.rows) {
+        if (row == NO_ROW) break;
+        
+        const InstrInfo &info = instrRows[row].info;
+        switch (info.format) {
+            case FixedType: if (word == info.match) return row; break;
+            case RType:
+            case ShiftType: if (word >> 25 == info.func7) return row; break;
+            default: return row;
+        }
+    }
+    return -1;
+}
+
+//
+// The immediates, sign-extended
+//
+static inline int immI(uint32_t word) { return (int32_t)word >> 20; }
+static inline int immS(uint32_t word) { return ((int32_t)word >> 25 << 5) | (word >> 7 & 0x1F); }
+
+static inline int immB(uint32_t word) {
+    return ((int32_t)word >> 31 << 12) | (word << 4 & 0x800) | (word >> 20 & 0x7E0) | (word >> 7 & 0x1E);
+}
+
+static inline int immJ(uint32_t word) {
+    return ((int32_t)word >> 31 << 20) | (word & 0xFF000) | (word >> 9 & 0x800) | (word >> 20 & 0x7FE);
+}
+
+//
+// The label a branch or jump goes to, as a word index, or -1 if the target
+// is not a word of the image (or just past its end)
+//
+static inline long getTarget(Syntax syntax, uint32_t word, size_t index, size_t words) {
+    int offset = syntax == SynBranch ? immB(word) : immJ(word);
+    if (offset & 3) return -1;
+    
+    long target = (long)index + offset / 4;
+    if (target < 0 || (size_t)target > words) return -1;
+    return target;
+}
+
+//
+// Text writers
+// Each writes at pos and returns the new end. The caller keeps pos in a
+// local, so the compiler can hold it in a register rather than reload it
+// after every byte written through it.
+//
+static inline char *putText(char *pos, const char *text, size_t length) {
+    memcpy(pos, text, length);
+    return pos + length;
+}
+
+static inline char *putHex(char *pos, uint32_t value) {
+    static const char digits[] = "0123456789abcdef";
+    for (int shift = 28; shift>=0; shift -= 4) {
+        *pos++ = digits[value >> shift & 0xF];
+    }
+    return pos;
+}
+
+static inline char *putNumber(char *pos, int value) {
+    uint32_t magnitude = (uint32_t)value;
+    if (value < 0) {
+        *pos++ = '-';
+        magnitude = 0 - magnitude;
+    }
+    
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    while (count > 0) *pos++ = digits[--count];
+    return pos;
+}
+
+//
+// Register names, padded to four bytes so they copy in one move
+//
+struct RegNames {
+    char text[2][32][4] = {};       // x and f
+    uint8_t length[32] = {};
+    
+    constexpr RegNames() {
+        for (int kind = 0; kind<2; kind++) {
+            for (int reg = 0; reg<32; reg++) {
+                int i = 0;
+                text[kind][reg][i++] = kind == 0 ? 'x' : 'f';
+                if (reg >= 10) text[kind][reg][i++] = (char)('0' + reg / 10);
+                text[kind][reg][i++] = (char)('0' + reg % 10);
+                length[reg] = (uint8_t)i;
+            }
+        }
+    }
+};
+
+static constexpr RegNames regNames;
+
+static inline char *putReg(char *pos, char kind, uint32_t reg) {
+    memcpy(pos, regNames.text[kind == 'f'][reg], 4);
+    return pos + regNames.length[reg];
+}
+
+static inline char *putLabel(char *pos, size_t index) {
+    *pos++ = 'L';
+    return putHex(pos, (uint32_t)(index * 4));
+}
+
+//
+// A run of words, decoded into its own part of the listing
+//
+struct DisasmChunk {
+    size_t begin;
+    size_t end;
+    std::vector<long> targets;
+    size_t instructions = 0;
+    size_t data = 0;
+    size_t lost = 0;
+};
+
+static inline uint32_t readWord(const char *bytes, size_t index) {
+    uint32_t word;
+    memcpy(&word, bytes + index * 4, sizeof(uint32_t));
+    return word;
+}
+
+//
+// Finds the branch and jump targets of a chunk
+//
+static void findTargets(DisasmChunk *chunk, const char *bytes, size_t words) {
+    for (size_t i = chunk->begin; i<chunk->end; i++) {
+        uint32_t word = readWord(bytes, i);
+        int row = decodeRow(word);
+        if (row == -1) continue;
+        
+        Syntax syntax = decodeTable.syntax[row];
+        if (syntax != SynBranch && syntax != SynJal) continue;
+        
+        long target = getTarget(syntax, word, i, words);
+        if (target != -1) chunk->targets.push_back(target);
+    }
+}
+
+//
+// Writes bytes that are not an instruction as a labelled string
+//
+static char *writeData(char *pos, DisasmChunk *chunk, const char *bytes, size_t length, size_t index, bool labelled) {
+    if (memchr(bytes, '\"', length)) {
+        // A branch to it still needs the label
+        if (labelled) {
+            pos = putLabel(pos, index);
+            pos = putText(pos, ":\n", 2);
+        }
+        uint32_t word = 0;
+        memcpy(&word, bytes, length);
+        pos = putText(pos, "; .word 0x", 10);
+        pos = putHex(pos, word);
+        ++chunk->lost;
+        return pos;
+    }
+    
+    pos = putLabel(pos, index);
+    pos = putText(pos, ": \"", 3);
+    pos = putText(pos, bytes, length);
+    *pos++ = '\"';
+    ++chunk->data;
+    return pos;
+}
+
+//
+// Writes the listing of a chunk into a buffer
+// The buffer keeps its length between chunks, so reusing it does not
+// clear it again; it only grows when a line might not fit.
+//
+static std::string_view writeChunk(DisasmChunk *chunk, std::string &buffer, const char *bytes, size_t words,
+                                   const std::vector<uint8_t> &labels, bool addresses) {
+    size_t size = (chunk->end - chunk->begin) * 24 + MAX_LINE;
+    if (buffer.length() < size) buffer.resize(size);
+    char *pos = &buffer[0];
+    char *end = pos + buffer.length();
+    
+    for (size_t i = chunk->begin; i<chunk->end; i++) {
+        if ((size_t)(end - pos) < MAX_LINE) {
+            size_t used = pos - buffer.data();
+            buffer.resize(buffer.length() * 2);
+            pos = &buffer[0] + used;
+            end = &buffer[0] + buffer.length();
+        }
+        
+        uint32_t word = readWord(bytes, i);
+        int row = decodeRow(word);
+        
+        Syntax syntax = row == -1 ? SynFixed : decodeTable.syntax[row];
+        long target = 0;
+        if (syntax == SynBranch || syntax == SynJal) {
+            target = getTarget(syntax, word, i, words);
+            
+            // A jump can still be written with its offset
+            if (target == -1 && syntax == SynBranch) row = -1;
+        }
+        
+        if (row == -1) {
+            pos = writeData(pos, chunk, bytes + i * 4, 4, i, labels[i]);
+        } else {
+            if (labels[i]) {
+                pos = putLabel(pos, i);
+                pos = putText(pos, ":\n", 2);
+            }
+            
+            memcpy(pos, decodeTable.name[row], 8);
+            pos += decodeTable.length[row];
+            if (syntax != SynFixed) *pos++ = ' ';
+            
+            uint32_t rd = word >> 7 & 0x1F;
+            uint32_t rs1 = word >> 15 & 0x1F;
+            uint32_t rs2 = word >> 20 & 0x1F;
+            switch (syntax) {
+                case SynFixed: break;
+                case SynR:
+                case SynFloatR: {
+                    char kind = syntax == SynR ? 'x' : 'f';
+                    pos = putReg(pos, kind, rd);
+                    pos = putText(pos, ", ", 2);
+                    pos = putReg(pos, kind, rs1);
+                    pos = putText(pos, ", ", 2);
+                    pos = putReg(pos, kind, rs2);
+                } break;
+                
+                case SynI:
+                case SynShift: {
+                    pos = putReg(pos, 'x', rd);
+                    pos = putText(pos, ", ", 2);
+                    pos = putReg(pos, 'x', rs1);
+                    pos = putText(pos, ", ", 2);
+                    pos = putNumber(pos, syntax == SynI ? immI(word) : (int)rs2);
+                } break;
+                
+                case SynLoad:
+                case SynFloatLoad:
+                case SynStore:
+                case SynFloatStore: {
+                    bool load = syntax == SynLoad || syntax == SynFloatLoad;
+                    bool isFloat = syntax == SynFloatLoad || syntax == SynFloatStore;
+                    pos = putReg(pos, isFloat ? 'f' : 'x', load ? rd : rs2);
+                    pos = putText(pos, ", ", 2);
+                    pos = putNumber(pos, load ? immI(word) : immS(word));
+                    *pos++ = '(';
+                    pos = putReg(pos, 'x', rs1);
+                    *pos++ = ')';
+                } break;
+                
+                case SynBranch: {
+                    pos = putReg(pos, 'x', rs1);
+                    pos = putText(pos, ", ", 2);
+                    pos = putReg(pos, 'x', rs2);
+                    pos = putText(pos, ", ", 2);
+                    pos = putLabel(pos, target);
+                } break;
+                
+                case SynU: {
+                    pos = putReg(pos, 'x', rd);
+                    pos = putText(pos, ", ", 2);
+                    pos = putNumber(pos, (int)(word >> 12));
+                } break;
+                
+                case SynJal: {
+                    pos = putReg(pos, 'x', rd);
+                    pos = putText(pos, ", ", 2);
+                    if (target == -1) pos = putNumber(pos, immJ(word));
+                    else pos = putLabel(pos, target);
+                } break;
+            }
+            ++chunk->instructions;
+        }
+        
+        if (addresses) {
+            pos = putText(pos, " ; ", 3);
+            pos = putHex(pos, (uint32_t)(i * 4));
+            *pos++ = ' ';
+            pos = putHex(pos, word);
+        }
+        *pos++ = '\n';
+    }
+    
+    return std::string_view(buffer.data(), pos - buffer.data());
+}
+
+//
+// Disassembles a flat binary, handing the listing to write() in order
+// The image is split into chunks. Every chunk first lists the targets it
+// branches to; once all are known, the chunks are written a few at a
+// time, each thread into a buffer it reuses, so the whole listing is
+// never held in memory.
+//
+Disassembly disassemble(std::string_view image, const DisasmOptions &options, const DisasmWriter &write) {
+    const char *bytes = image.data();
+    size_t words = image.length() / 4;
+    
+    std::vector<DisasmChunk> chunks((words + CHUNK_WORDS - 1) / CHUNK_WORDS);
+    for (size_t i = 0; i<chunks.size(); i++) {
+        chunks[i].begin = i * CHUNK_WORDS;
+        chunks[i].end = i + 1 == chunks.size() ? words : (i + 1) * CHUNK_WORDS;
+    }
+    
+    unsigned jobs = options.jobs == 0 ? 1 : options.jobs;
+    WorkPool *pool = new WorkPool(jobs);
+    pool->run(chunks.size(), [&](size_t i) {
+        findTargets(&chunks[i], bytes, words);
+    });
+    
+    // One more slot for a label just past the last word
+    std::vector<uint8_t> labels(words + 1, 0);
+    for (DisasmChunk &chunk : chunks) {
+        for (long target : chunk.targets) labels[target] = 1;
+        chunk.targets = std::vector<long>();
+    }
+    
+    Disassembly result;
+    size_t wave = jobs * 2;
+    std::vector<std::string> buffers(wave);
+    std::vector<std::string_view> texts(wave);
+    for (size_t first = 0; first<chunks.size(); first += wave) {
+        size_t count = chunks.size() - first < wave ? chunks.size() - first : wave;
+        pool->run(count, [&](size_t i) {
+            texts[i] = writeChunk(&chunks[first + i], buffers[i], bytes, words, labels, options.addresses);
+        });
+        
+        for (size_t i = 0; i<count; i++) {
+            DisasmChunk &chunk = chunks[first + i];
+            write(texts[i]);
+            result.instructions += chunk.instructions;
+            result.data += chunk.data;
+            result.lost += chunk.lost;
+        }
+    }
+    delete pool;
+    
+    // A trailing partial word is data; a label past the end is written
+    // on its own
+    size_t tail = image.length() % 4;
+    if (tail > 0 || labels[words]) {
+        char last[MAX_LINE];
+        char *pos = last;
+        DisasmChunk chunk;
+        if (tail > 0) {
+            pos = writeData(pos, &chunk, bytes + words * 4, tail, words, labels[words]);
+        } else {
+            pos = putLabel(pos, words);
+            *pos++ = ':';
+        }
+        *pos++ = '\n';
+        write(std::string_view(last, pos - last));
+        result.data += chunk.data;
+        result.lost += chunk.lost;
+    }
+    
+    return result;
+}
+
+//
+// Disassembles a flat binary into a string
+//
+Disassembly disassemble(std::string_view image, std::string &text, const DisasmOptions &options) {
+    text.reserve(text.length() + image.length() * 5);
+    return disassemble(image, options, [&](std::string_view part) {
+        text.append(part.data(), part.length());
+    });
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+
+//
+// The disassembler
+// Turns a flat binary back into source the assembler accepts, so an
+// image can be checked by assembling the listing again. Words are decoded
+// through a table indexed by opcode and func3, with func7 telling apart
+// the instructions that share a slot.
+//
+// Branch and jump targets inside the image get a label named after their
+// address ("L" and eight hex digits). A word that does not decode, or
+// branches outside the image, is written as a labelled string holding
+// its bytes. A word with a '"' byte cannot be put in a string; it is
+// written as a comment and counted as lost.
+//
+struct DisasmOptions {
+    unsigned jobs = 1;          // Threads for large images
+    bool addresses = false;     // Comment each line with its address and word
+};
+
+struct Disassembly {
+    size_t instructions = 0;
+    size_t data = 0;            // Words written as strings
+    size_t lost = 0;            // Words written as comments
+};
+
+using DisasmWriter = std::function<void(std::string_view)>;
+
+Disassembly disassemble(std::string_view image, const DisasmOptions &options, const DisasmWriter &write);
+Disassembly disassemble(std::string_view image, std::string &text, const DisasmOptions &options = DisasmOptions());
@@ -0,0 +1,187 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "elf.hpp"
+
+// Section indices
+enum {
+    SecNull,
+    SecText,
+    SecData,
+    SecRela,
+    SecSymtab,
+    SecStrtab,
+    SecShstrtab,
+    SecCount
+};
+
+//
+// Adds a name to a string table and returns its offset
+//
+static uint32_t addName(std::string &table, std::string_view name) {
+    uint32_t offset = (uint32_t)table.length();
+    table.append(name.data(), name.length());
+    table += '\0';
+    return offset;
+}
+
+static size_t align(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t getRelocType(RelocType type) {
+    switch (type) {
+        case RelocBranch: return R_RISCV_BRANCH;
+        case RelocJal: return R_RISCV_JAL;
+        case RelocHi20: return R_RISCV_HI20;
+        case RelocLo12: return R_RISCV_LO12_I;
+    }
+    return R_RISCV_NONE;
+}
+
+//
+// Writes the image as a relocatable object
+//
+template<class Elf>
+void writeElf(const Image &image, Sink &sink) {
+    using Sym = typename Elf::Sym;
+    using Shdr = typename Elf::Shdr;
+    
+    std::string strtab(1, '\0');
+    std::string shstrtab(1, '\0');
+    
+    // Locals go first: the section, the mapping symbols, then .L labels
+    std::vector<Sym> syms(1);
+    auto addSymbol = [&](uint32_t name, size_t value, unsigned char bind, unsigned char type, uint16_t section) {
+        Sym sym = {};
+        sym.st_name = name;
+        sym.st_value = value;
+        sym.st_info = ELF32_ST_INFO(bind, type);
+        sym.st_shndx = section;
+        syms.push_back(sym);
+    };
+    
+    addSymbol(0, 0, STB_LOCAL, STT_SECTION, SecText);
+    
+    size_t size = image.bytes.size();
+    if (size > 0) {
+        uint32_t code = addName(strtab, "$x");
+        uint32_t data = addName(strtab, "$d");
+        size_t offset = 0;
+        for (auto range : image.data) {
+            if (range.first > offset) addSymbol(code, offset, STB_LOCAL, STT_NOTYPE, SecText);
+            addSymbol(data, range.first, STB_LOCAL, STT_NOTYPE, SecText);
+            offset = range.first + range.second;
+        }
+        if (offset < size) addSymbol(code, offset, STB_LOCAL, STT_NOTYPE, SecText);
+    }
+    
+    std::vector<uint32_t> index(image.symbols.size());
+    for (int pass = 0; pass<2; pass++) {
+        bool global = pass == 1;
+        for (size_t i = 0; i<image.symbols.size(); i++) {
+            const ImageSymbol &symbol = image.symbols[i];
+            bool local = symbol.defined && symbol.name.compare(0, 2, ".L") == 0;
+            if (local == global) continue;
+            
+            index[i] = (uint32_t)syms.size();
+            uint16_t section = symbol.defined ? SecText : SHN_UNDEF;
+            addSymbol(addName(strtab, symbol.name), symbol.defined ? symbol.address : 0,
+                      global ? STB_GLOBAL : STB_LOCAL, STT_NOTYPE, section);
+        }
+    }
+    
+    // The first global comes after every local
+    uint32_t firstGlobal = (uint32_t)syms.size();
+    for (size_t i = 0; i<syms.size(); i++) {
+        if (ELF32_ST_BIND(syms[i].st_info) == STB_GLOBAL) {
+            firstGlobal = (uint32_t)i;
+            break;
+        }
+    }
+    
+    std::vector<typename Elf::Rela> relas;
+    for (const Reloc &reloc : image.relocs) {
+        typename Elf::Rela rela = {};
+        rela.r_offset = reloc.offset;
+        rela.r_info = Elf::info(index[reloc.sym], getRelocType(reloc.type));
+        rela.r_addend = 0;
+        relas.push_back(rela);
+    }
+    
+    // Lay the file out: header, section contents, section headers
+    std::vector<Shdr> sections(SecCount);
+    size_t offset = sizeof(typename Elf::Ehdr);
+    const char *names[SecCount] = { "", ".text", ".data", ".rela.text", ".symtab", ".strtab", ".shstrtab" };
+    for (int i = 1; i<SecCount; i++) {
+        sections[i].sh_name = addName(shstrtab, names[i]);
+    }
+    
+    auto place = [&](int section, uint32_t type, size_t length, size_t alignment) {
+        Shdr &shdr = sections[section];
+        offset = align(offset, alignment);
+        shdr.sh_type = type;
+        shdr.sh_offset = offset;
+        shdr.sh_size = length;
+        shdr.sh_addralign = alignment;
+        offset += length;
+    };
+    
+    place(SecText, SHT_PROGBITS, size, 4);
+    place(SecData, SHT_PROGBITS, 0, 1);
+    place(SecRela, SHT_RELA, relas.size() * sizeof(typename Elf::Rela), 8);
+    place(SecSymtab, SHT_SYMTAB, syms.size() * sizeof(Sym), 8);
+    place(SecStrtab, SHT_STRTAB, strtab.length(), 1);
+    place(SecShstrtab, SHT_STRTAB, shstrtab.length(), 1);
+    size_t sectionsOffset = align(offset, 8);
+    
+    sections[SecText].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[SecData].sh_flags = SHF_ALLOC | SHF_WRITE;
+    sections[SecRela].sh_flags = SHF_INFO_LINK;
+    sections[SecRela].sh_link = SecSymtab;
+    sections[SecRela].sh_info = SecText;
+    sections[SecRela].sh_entsize = sizeof(typename Elf::Rela);
+    sections[SecSymtab].sh_link = SecStrtab;
+    sections[SecSymtab].sh_info = firstGlobal;
+    sections[SecSymtab].sh_entsize = sizeof(Sym);
+    
+    typename Elf::Ehdr header = {};
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = Elf::elfClass;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_RISCV;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = sectionsOffset;
+    header.e_ehsize = sizeof(typename Elf::Ehdr);
+    header.e_shentsize = sizeof(Shdr);
+    header.e_shnum = SecCount;
+    header.e_shstrndx = SecShstrtab;
+    
+    // Write everything in file order, padding up to each offset
+    size_t written = 0;
+    auto emit = [&](size_t at, const void *data, size_t length) {
+        static const char zeros[8] = {};
+        while (written < at) {
+            size_t pad = at - written < sizeof(zeros) ? at - written : sizeof(zeros);
+            sink.write(zeros, pad);
+            written += pad;
+        }
+        if (length > 0) sink.write(data, length);
+        written += length;
+    };
+    
+    emit(0, &header, sizeof(header));
+    emit(sections[SecText].sh_offset, image.bytes.data(), size);
+    emit(sections[SecRela].sh_offset, relas.data(), relas.size() * sizeof(typename Elf::Rela));
+    emit(sections[SecSymtab].sh_offset, syms.data(), syms.size() * sizeof(Sym));
+    emit(sections[SecStrtab].sh_offset, strtab.data(), strtab.length());
+    emit(sections[SecShstrtab].sh_offset, shstrtab.data(), shstrtab.length());
+    emit(sectionsOffset, sections.data(), sections.size() * sizeof(Shdr));
+}
+
+template void writeElf<Elf32>(const Image &image, Sink &sink);
+template void writeElf<Elf64>(const Image &image, Sink &sink);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <elf.h>
+
+#include "output.hpp"
+
+//
+// ELF relocatable objects
+// The image goes into .text as it is laid out, strings included; mapping
+// symbols ($x, $d) mark which parts are instructions and which are data.
+// The source has no section directives, so .data is always empty.
+//
+// Labels starting with ".L" are local to the object, all others are
+// global. Labels the image uses but does not define are undefined
+// symbols, for the linker to resolve.
+//
+struct Elf32 {
+    using Ehdr = Elf32_Ehdr;
+    using Shdr = Elf32_Shdr;
+    using Sym = Elf32_Sym;
+    using Rela = Elf32_Rela;
+    static constexpr unsigned char elfClass = ELFCLASS32;
+    
+    static Elf32_Word info(uint32_t sym, uint32_t type) { return ELF32_R_INFO(sym, type); }
+};
+
+struct Elf64 {
+    using Ehdr = Elf64_Ehdr;
+    using Shdr = Elf64_Shdr;
+    using Sym = Elf64_Sym;
+    using Rela = Elf64_Rela;
+    static constexpr unsigned char elfClass = ELFCLASS64;
+    
+    static Elf64_Xword info(uint32_t sym, uint32_t type) { return ELF64_R_INFO(sym, type); }
+};
+
+template<class Elf>
+void writeElf(const Image &image, Sink &sink);
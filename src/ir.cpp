@@ -0,0 +1,37 @@
+#include "ir.hpp"
+
+//
+// Adds a data string
+//
+void Program::addData(std::string_view data, int line) {
+    add(String, 0, 0, 0, (int)this->data.size(), false, line);
+    this->data.push_back({ (uint32_t)text.length(), (uint32_t)data.length() });
+    text.append(data.data(), data.length());
+    bytes += data.length();
+}
+
+void Program::reserve(size_t count) {
+    op.reserve(count);
+    rd.reserve(count);
+    rs1.reserve(count);
+    rs2.reserve(count);
+    imm.reserve(count);
+    label.reserve(count);
+    line.reserve(count);
+}
+
+//
+// Empties the program but keeps its memory for the next block
+//
+void Program::clear() {
+    op.clear();
+    rd.clear();
+    rs1.clear();
+    rs2.clear();
+    imm.clear();
+    label.clear();
+    line.clear();
+    text.clear();
+    data.clear();
+    bytes = 0;
+}
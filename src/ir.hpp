@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lex.hpp"
+
+//
+// A string in the program text
+//
+struct DataRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+//
+// What the label operand of an entry stands for
+// Most instructions take it from their format; the auipc and jalr of a
+// relaxed jump split the offset between them.
+//
+enum LabelKind : uint8_t {
+    LabelNone,
+    LabelRef,
+    LabelPcHi,      // Upper bits of the offset from this entry
+    LabelPcLo       // Lower bits of the offset from the entry before
+};
+
+//
+// The parsed program as a struct of arrays
+// Parsing adds one entry per instruction or data string, in source order,
+// and the encoder turns the entries into bytes in a separate loop. Fields
+// an instruction does not use are zero.
+//
+// If label is set, it is a LabelKind and imm holds the symbol id of the
+// label operand. Data strings have the op String, and their imm is an
+// index into data.
+//
+struct Program {
+    std::vector<TokenType> op;
+    std::vector<uint8_t> rd;
+    std::vector<uint8_t> rs1;
+    std::vector<uint8_t> rs2;
+    std::vector<int32_t> imm;
+    std::vector<uint8_t> label;
+    std::vector<uint32_t> line;
+    
+    // Strings are copied, since a streamed source does not keep them
+    std::string text;
+    std::vector<DataRef> data;
+    
+    size_t bytes = 0;       // Size of the entries once encoded
+    
+    size_t size() const { return op.size(); }
+    void add(TokenType op, int rd, int rs1, int rs2, int imm, uint8_t label, int line) {
+        this->op.push_back(op);
+        this->rd.push_back((uint8_t)rd);
+        this->rs1.push_back((uint8_t)rs1);
+        this->rs2.push_back((uint8_t)rs2);
+        this->imm.push_back(imm);
+        this->label.push_back(label);
+        this->line.push_back((uint32_t)line);
+        if (op != String) bytes += 4;
+    }
+    void addData(std::string_view data, int line);
+    void reserve(size_t count);
+    void clear();
+};
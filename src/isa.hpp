@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+
+#include "lex.hpp"
+
+//
+// The instruction formats
+// Each format places the operands in the same fields, so one encoder per
+// format covers every instruction of that format.
+//
+enum InstrFormat : uint8_t {
+    NoFormat,       // Not an instruction
+    RType,          // rd, rs1, rs2
+    IType,          // rd, rs1, imm[11:0] (also loads, jalr, ecall)
+    ShiftType,      // rd, rs1, shamt; func7 above the shift amount
+    SType,          // rs1, rs2, imm[11:0] split around func3
+    BType,          // rs1, rs2, scattered branch offset
+    UType,          // rd, imm[31:12]
+    JType,          // rd, scattered jump offset
+    FixedType       // No operands; the whole word comes from the table
+};
+
+//
+// Describes how to encode an instruction
+// match is the word with every operand field zero, so encoding is the
+// match ORed with the operands shifted into place.
+//
+struct InstrInfo {
+    InstrFormat format = NoFormat;
+    uint8_t opcode = 0;
+    uint8_t func3 = 0;
+    uint8_t func7 = 0;
+    uint32_t match = 0;
+};
+
+constexpr InstrInfo instr(InstrFormat format, uint8_t opcode, uint8_t func3 = 0, uint8_t func7 = 0) {
+    uint32_t match = opcode | (uint32_t)func3 << 12 | (uint32_t)func7 << 25;
+    return { format, opcode, func3, func7, match };
+}
+
+constexpr InstrInfo fixed(uint32_t word) {
+    return { FixedType, (uint8_t)(word & 0x7F), (uint8_t)((word >> 12) & 0x7), (uint8_t)(word >> 25), word };
+}
+
+//
+// The instruction table
+// Adding an instruction means adding its token to the lexer and a row here.
+//
+struct InstrRow {
+    TokenType type;
+    const char *name;       // As the lexer spells it
+    InstrInfo info;
+};
+
+static constexpr InstrRow instrRows[] = {
+    { Nop, "nop", fixed(0) },
+    { Hlt, "hlt", fixed(0xFFFFFFFF) },
+    
+    { Add, "add", instr(RType, 0b0110011, 0b000) },
+    { Sub, "sub", instr(RType, 0b0110011, 0b000, 0b0100000) },
+    { Sll, "sll", instr(RType, 0b0110011, 0b001) },
+    { Slt, "slt", instr(RType, 0b0110011, 0b010) },
+    { Sltu, "sltu", instr(RType, 0b0110011, 0b011) },
+    { Xor, "xor", instr(RType, 0b0110011, 0b100) },
+    { Srl, "srl", instr(RType, 0b0110011, 0b101) },
+    { Sra, "sra", instr(RType, 0b0110011, 0b101, 0b0100000) },
+    { Or, "or", instr(RType, 0b0110011, 0b110) },
+    { And, "and", instr(RType, 0b0110011, 0b111) },
+    
+    { Addi, "addi", instr(IType, 0b0010011, 0b000) },
+    { Slti, "slti", instr(IType, 0b0010011, 0b010) },
+    { Sltiu, "sltiu", instr(IType, 0b0010011, 0b011) },
+    { Xori, "xori", instr(IType, 0b0010011, 0b100) },
+    { Ori, "ori", instr(IType, 0b0010011, 0b110) },
+    { Andi, "andi", instr(IType, 0b0010011, 0b111) },
+    { Slli, "slli", instr(ShiftType, 0b0010011, 0b001) },
+    { Srli, "srli", instr(ShiftType, 0b0010011, 0b101) },
+    { Srai, "srai", instr(ShiftType, 0b0010011, 0b101, 0b0100000) },
+    
+    { Lb, "lb", instr(IType, 0b0000011, 0b000) },
+    { Lh, "lh", instr(IType, 0b0000011, 0b001) },
+    { Lw, "lw", instr(IType, 0b0000011, 0b010) },
+    { Lbu, "lbu", instr(IType, 0b0000011, 0b100) },
+    { Lhu, "lhu", instr(IType, 0b0000011, 0b101) },
+    
+    { Sb, "sb", instr(SType, 0b0100011, 0b000) },
+    { Sh, "sh", instr(SType, 0b0100011, 0b001) },
+    { Sw, "sw", instr(SType, 0b0100011, 0b010) },
+    
+    { Beq, "beq", instr(BType, 0b1100011, 0b000) },
+    { Bne, "bne", instr(BType, 0b1100011, 0b001) },
+    { Blt, "blt", instr(BType, 0b1100011, 0b100) },
+    { Bge, "bge", instr(BType, 0b1100011, 0b101) },
+    { Bltu, "bltu", instr(BType, 0b1100011, 0b110) },
+    { Bgeu, "bgeu", instr(BType, 0b1100011, 0b111) },
+    
+    { Lui, "lui", instr(UType, 0b0110111) },
+    { Auipc, "auipc", instr(UType, 0b0010111) },
+    { Jal, "jal", instr(JType, 0b1101111) },
+    { Jalr, "jalr", instr(IType, 0b1100111, 0b000) },
+    { Ecall, "ecall", instr(IType, 0b1100111, 0b111) },
+    
+    // Float math always uses the dynamic rounding mode
+    { Flw, "flw", instr(IType, 0b0000111, 0b010) },
+    { Fsw, "fsw", instr(SType, 0b0100111, 0b010) },
+    { Fadds, "fadd.s", instr(RType, 0b1010011, 0b111, 0b0000000) },
+    { Fsubs, "fsub.s", instr(RType, 0b1010011, 0b111, 0b0000100) },
+};
+
+struct InstrTable {
+    InstrInfo info[String + 1] = {};
+    bool unique = true;
+    
+    constexpr InstrTable() {
+        for (const InstrRow &row : instrRows) {
+            if (info[row.type].format != NoFormat) unique = false;
+            info[row.type] = row.info;
+        }
+    }
+    
+    constexpr const InstrInfo &operator[](TokenType type) const { return info[type]; }
+};
+
+inline constexpr InstrTable instrTable;
+static_assert(instrTable.unique, "An instruction has more than one row in the instruction table.");
+
+//
+// Encodes the scattered immediate of a B-Type instruction
+//
+constexpr uint32_t encodeBranch(int imm) {
+    uint32_t imm1 = (uint32_t)((imm & 0x00800) >> 11);      // Bit 11
+            imm1 |= (uint32_t)(imm & 0b00011110);           // Bit [4:1]
+    uint32_t imm2 = (uint32_t)((imm & 0x007E0) >> 5);       // Bit [10:5]
+            imm2 |= (uint32_t)((imm & 0x01000) >> 6);       // Bit 12
+    
+    return (imm1 << 7) | (imm2 << 25);
+}
+
+//
+// Encodes the scattered immediate of a J-Type instruction
+//
+constexpr uint32_t encodeJal(uint32_t imm) {
+    uint32_t imm1 = (uint32_t)((imm & 0x0FF000) >> 12);     // imm[19:12]    -> 0:7
+            imm1 |= (uint32_t)((imm & 0x0800) >> 3);        // imm[11]       -> 8
+            imm1 |= (uint32_t)((imm & 0x07FE) << 8);        // imm[10:1]     -> 9:18
+            imm1 |= (uint32_t)((imm & 0x100000) >> 1);      // imm[20]       -> 19
+    
+    return imm1 << 12;
+}
+
+//
+// True if a pc-relative offset fits a B-Type or J-Type field
+//
+constexpr bool fitsBranch(int offset) {
+    return offset >= -4096 && offset <= 4094;
+}
+
+constexpr bool fitsJal(int offset) {
+    return offset >= -(1 << 20) && offset <= (1 << 20) - 2;
+}
+
+//
+// Encodes an instruction from its operands
+// Operands the format does not use are ignored.
+//
+constexpr uint32_t encode(const InstrInfo &info, uint32_t rd, uint32_t rs1, uint32_t rs2, int imm) {
+    uint32_t instr = info.match;
+    switch (info.format) {
+        case RType: return instr | rd << 7 | rs1 << 15 | rs2 << 20;
+        case IType: return instr | rd << 7 | rs1 << 15 | (uint32_t)imm << 20;
+        case ShiftType: return instr | rd << 7 | rs1 << 15 | (uint32_t)(uint8_t)imm << 20;
+        case SType: return instr | ((uint32_t)imm & 0x1F) << 7 | rs1 << 15 | rs2 << 20 | ((uint32_t)imm >> 5 & 0x7F) << 25;
+        case BType: return instr | rs1 << 15 | rs2 << 20 | encodeBranch(imm);
+        case UType: return instr | rd << 7 | (uint32_t)imm << 12;
+        case JType: return instr | rd << 7 | encodeJal(imm);
+        
+        default: {}
+    }
+    return instr;
+}
+
+constexpr uint32_t encode(TokenType type, uint32_t rd, uint32_t rs1, uint32_t rs2, int imm) {
+    return encode(instrTable[type], rd, rs1, rs2, imm);
+}
+
+// Known encodings, so the compiler checks the table
+static_assert(encode(Add, 1, 2, 3, 0) == 0x003100b3, "add x1, x2, x3");
+static_assert(encode(Sub, 1, 2, 3, 0) == 0x403100b3, "sub x1, x2, x3");
+static_assert(encode(Sltu, 5, 6, 7, 0) == 0x007332b3, "sltu x5, x6, x7");
+static_assert(encode(Addi, 1, 2, 0, 20) == 0x01410093, "addi x1, x2, 20");
+static_assert(encode(Addi, 1, 2, 0, -1) == 0xfff10093, "addi x1, x2, -1");
+static_assert(encode(Srai, 1, 2, 0, 3) == 0x40315093, "srai x1, x2, 3");
+static_assert(encode(Lw, 1, 2, 0, 8) == 0x00812083, "lw x1, 8(x2)");
+static_assert(encode(Lhu, 3, 4, 0, -4) == 0xffc25183, "lhu x3, -4(x4)");
+static_assert(encode(Sw, 0, 2, 1, 20) == 0x00112a23, "sw x1, 20(x2)");
+static_assert(encode(Sb, 0, 2, 1, -1) == 0xfe110fa3, "sb x1, -1(x2)");
+static_assert(encode(Beq, 0, 4, 5, 24) == 0x00520c63, "beq x4, x5, +24");
+static_assert(encode(Beq, 0, 0, 0, -8) == 0xfe000ce3, "beq x0, x0, -8");
+static_assert(encode(Lui, 1, 0, 0, 0x12345) == 0x123450b7, "lui x1, 0x12345");
+static_assert(encode(Auipc, 1, 0, 0, 1) == 0x00001097, "auipc x1, 1");
+static_assert(encode(Jal, 12, 0, 0, 8) == 0x0080066f, "jal x12, +8");
+static_assert(encode(Jal, 0, 0, 0, -4) == 0xffdff06f, "jal x0, -4");
+static_assert(encode(Jal, 1, 0, 0, 2048) == 0x001000ef, "jal x1, +2048");
+static_assert(encode(Jalr, 0, 1, 0, 0) == 0x00008067, "jalr x0, x1, 0");
+static_assert(encode(Flw, 10, 1, 0, 23) == 0x0170a507, "flw f10, 23(x1)");
+static_assert(encode(Fsw, 0, 3, 20, 44) == 0x0341a627, "fsw f20, 44(x3)");
+static_assert(encode(Fadds, 2, 3, 4, 0) == 0x0041f153, "fadd.s f2, f3, f4");
+static_assert(encode(Fsubs, 2, 3, 4, 0) == 0x0841f153, "fsub.s f2, f3, f4");
+static_assert(encode(Hlt, 0, 0, 0, 0) == 0xFFFFFFFF, "hlt");
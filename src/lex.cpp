@@ -1,96 +1,276 @@
 #include <iostream>
+#include <iterator>
+#include <charconv>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
 
 #include "lex.hpp"
+#include "scan.hpp"
+
+// The size of each read from a streaming input
+constexpr size_t STREAM_BLOCK = 64 * 1024;
+
+//
+// The keyword table
+// Every mnemonic and register name fits in 8 bytes, so a name is packed into
+// an integer and hashed with a multiply-shift. The seed was picked so that no
+// two keywords share a slot; a lookup is therefore a single probe and a single
+// integer compare.
+//
+struct Keyword {
+    const char *name;
+    TokenType type;
+};
+
+static constexpr Keyword keywords[] = {
+    { "nop", Nop }, { "hlt", Hlt }, { "ecall", Ecall },
+    
+    { "add", Add }, { "sub", Sub }, { "sll", Sll }, { "slt", Slt },
+    { "sltu", Sltu }, { "xor", Xor }, { "srl", Srl }, { "sra", Sra },
+    { "or", Or }, { "and", And },
+    
+    { "addi", Addi }, { "slli", Slli }, { "slti", Slti }, { "sltiu", Sltiu },
+    { "xori", Xori }, { "srli", Srli }, { "srai", Srai }, { "ori", Ori },
+    { "andi", Andi },
+    
+    { "lb", Lb }, { "lh", Lh }, { "lw", Lw }, { "lbu", Lbu },
+    { "lhu", Lhu },
+    
+    { "sb", Sb }, { "sh", Sh }, { "sw", Sw },
+    
+    { "beq", Beq }, { "bne", Bne }, { "blt", Blt }, { "bge", Bge },
+    { "bltu", Bltu }, { "bgeu", Bgeu },
+    
+    { "lui", Lui }, { "auipc", Auipc }, { "jal", Jal }, { "jalr", Jalr },
+    
+    { "flw", Flw }, { "fsw", Fsw }, { "fadd.s", Fadds }, { "fsub.s", Fsubs },
+    
+    { "x0", X0 }, { "x1", X1 }, { "x2", X2 }, { "x3", X3 },
+    { "x4", X4 }, { "x5", X5 }, { "x6", X6 }, { "x7", X7 },
+    { "x8", X8 }, { "x9", X9 }, { "x10", X10 }, { "x11", X11 },
+    { "x12", X12 }, { "x13", X13 }, { "x14", X14 }, { "x15", X15 },
+    { "x16", X16 }, { "x17", X17 }, { "x18", X18 }, { "x19", X19 },
+    { "x20", X20 }, { "x21", X21 }, { "x22", X22 }, { "x23", X23 },
+    { "x24", X24 }, { "x25", X25 }, { "x26", X26 }, { "x27", X27 },
+    { "x28", X28 }, { "x29", X29 }, { "x30", X30 }, { "x31", X31 },
+    
+    { "bp", Bp }, { "ra", Ra }, { "sp", Sp },
+    
+    { "f0", F0 }, { "f1", F1 }, { "f2", F2 }, { "f3", F3 },
+    { "f4", F4 }, { "f5", F5 }, { "f6", F6 }, { "f7", F7 },
+    { "f8", F8 }, { "f9", F9 }, { "f10", F10 }, { "f11", F11 },
+    { "f12", F12 }, { "f13", F13 }, { "f14", F14 }, { "f15", F15 },
+    { "f16", F16 }, { "f17", F17 }, { "f18", F18 }, { "f19", F19 },
+    { "f20", F20 }, { "f21", F21 }, { "f22", F22 }, { "f23", F23 },
+    { "f24", F24 }, { "f25", F25 }, { "f26", F26 }, { "f27", F27 },
+    { "f28", F28 }, { "f29", F29 }, { "f30", F30 }, { "f31", F31 },
+};
+
+constexpr int KEYWORD_BITS = 9;
+constexpr uint64_t KEYWORD_SEED = 0xc2a2b8c4e79115cd;
+
+struct KeywordTable {
+    uint64_t keys[1 << KEYWORD_BITS] = {};
+    uint8_t types[1 << KEYWORD_BITS] = {};
+    bool perfect = true;
+};
+
+constexpr size_t keywordSlot(uint64_t key) {
+    return (size_t)((key * KEYWORD_SEED) >> (64 - KEYWORD_BITS));
+}
+
+constexpr KeywordTable buildKeywordTable() {
+    KeywordTable table;
+    for (const Keyword &kw : keywords) {
+        uint64_t key = 0;
+        int i = 0;
+        for (; kw.name[i] != 0; i++) {
+            key |= (uint64_t)(uint8_t)kw.name[i] << (i * 8);
+        }
+        
+        size_t slot = keywordSlot(key);
+        if (i > 8 || table.keys[slot] != 0) table.perfect = false;
+        table.keys[slot] = key;
+        table.types[slot] = (uint8_t)kw.type;
+    }
+    return table;
+}
+
+static constexpr KeywordTable keywordTable = buildKeywordTable();
+static_assert(keywordTable.perfect, "Keyword table has a collision; pick a new KEYWORD_SEED.");
 
 //
 // Setups the lexical analyzer
 //
 Lex::Lex(std::string input) {
-    reader = std::ifstream(input);
-    if (reader.is_open()) {}
+    file = new MappedFile(input);
+    failed = !file->isOpen();
+    pos = file->getText().data();
+    end = pos + file->getText().length();
 }
 
 //
-// Gets the next token in the stream
+// Scans a buffer that is already in memory
+// The caller keeps the buffer alive for as long as the tokens are used
 //
-Token Lex::getNext() {
-    if (!stack.empty()) {
-        Token token = stack.top();
-        stack.pop();
-        return token;
+Lex::Lex(const char *source, size_t length) {
+    pos = source;
+    end = source + length;
+}
+
+//
+// Replays a buffer of tokens
+// The tokens still point into the scanner that produced them, so that
+// scanner has to outlive this one
+//
+Lex::Lex(const Token *begin, const Token *end) {
+    next = begin;
+    last = end;
+}
+
+//
+// Streams from an input stream through a small window
+//
+Lex::Lex(std::istream *stream) {
+    this->stream = stream;
+    data.resize(STREAM_BLOCK);
+    pos = data.data();
+    end = pos;
+    lineEnd = end;
+}
+
+Lex::~Lex() {
+    delete file;
+}
+
+//
+// Makes sure the stream window holds the rest of the current line
+//
+void Lex::fillLine() {
+    lineEnd = scanByte(*scanner, pos, end, '\n');
+    while (lineEnd == end && refill(pos)) {
+        lineEnd = scanByte(*scanner, pos, end, '\n');
     }
+}
+
+//
+// Moves [keep, end) to the front of the stream window and reads more input
+// behind it. The window only grows if a single line outgrows it.
+// Returns false once the stream is exhausted
+//
+bool Lex::refill(const char *&keep) {
+    if (!stream || !stream->good()) return false;
+    
+    size_t tail = end - keep;
+    size_t offset = pos - keep;
+    memmove(&data[0], keep, tail);
+    if (data.size() < tail + STREAM_BLOCK) data.resize(tail + STREAM_BLOCK);
+    
+    stream->read(&data[tail], data.size() - tail);
+    size_t count = stream->gcount();
+    
+    keep = data.data();
+    pos = keep + offset;
+    end = keep + tail + count;
+    lineEnd = end;
+    return count > 0;
+}
 
+//
+// Gets the next token in the stream
+//
+Token Lex::getNext() {
     Token token;
     token.type = Eof;
-    if (reader.eof()) {
-        return token;
+    
+    if (next) {
+        if (next == last) return token;
+        return *next++;
     }
     
-    while (!reader.eof()) {
-        char c = reader.get();
-        
-        // Check to see if we have a comment
-        if (c == ';') {
-            while (c != '\n' && !reader.eof()) {
-                c = reader.get();
-            }
-            c = reader.get();
+    if (stream && (pos > lineEnd || lineEnd == end)) {
+        fillLine();
+    }
+    
+    // Skip whitespace and comments
+    // A comment runs up to, but not including, the newline
+    while (pos < end) {
+        if (*pos == ' ') {
+            ++pos;
+            if (pos < end && *pos == ' ') pos = scanNonSpace(*scanner, pos, end);
+        } else if (*pos == ';') {
+            pos = scanByte(*scanner, pos, end, '\n');
+        } else {
+            break;
         }
+    }
+    
+    if (pos == end) {
+        return token;
+    }
+    
+    char c = *pos;
+    
+    if (isSymbol(c)) {
+        ++pos;
+        token.type = getSymbol(c);
+        return token;
+    }
+    
+    if (c == '\"') {
+        const char *start = ++pos;
+        pos = scanByte(*scanner, pos, end, '\"');
         
-        if (c == '\"') {
-            std::string s = "";
-            while (!reader.eof()) {
-                c = reader.get();
-                if (c == '\"') {
-                    break;
-                }
-                s += c;
-            }
-            
-            token.id = s;
-            token.type = String;
-            return token;
+        // A string can run past the end of the stream window
+        while (pos == end && refill(start)) {
+            pos = scanByte(*scanner, pos, end, '\"');
         }
         
-        // Otherwise do normal processing
-        if (c == ' ' || isSymbol(c)) {
-            if (isSymbol(c)) {
-                if (buffer.length() == 0) {
-                    token.type = getSymbol(c);
-                    return token;
-                } else {
-                    Token token2;
-                    token2.type = getSymbol(c);
-                    stack.push(token2);
-                }
-            }
-            
-            if (buffer.length() == 0) continue;
-            
-            if (isKeyword()) {
-                token.type = getKeyword();
-                buffer = "";
-                return token;
-            } else if (isInt()) {
-                token.type = Imm;
-                token.imm = std::stoi(buffer);
-                buffer = "";
-                return token;
-            } else {
-                token.type = Id;
-                token.id = buffer;
-                buffer = "";
-                return token;
-            }
-        } else {
-            buffer += c;
-        }  
+        token.id = std::string_view(start, pos - start);
+        token.type = String;
+        if (pos < end) ++pos;
+        else openString = true;
+        return token;
+    }
+    
+    // Otherwise scan up to the next delimiter
+    const char *start = pos;
+    pos = scanDelimiter(*scanner, pos, end);
+    buffer = std::string_view(start, pos - start);
+    
+    TokenType type = getKeyword();
+    if (type != None) {
+        token.type = type;
+    } else if (isInt()) {
+        token.type = Imm;
+        token.imm = getInt();
+    } else {
+        token.type = Id;
+        token.id = buffer;
+        token.sym = symbols ? symbols->intern(buffer) : -1;
     }
     
     return token;
 }
 
+//
+// Lexes the rest of the input into a contiguous buffer
+// The final Eof token is not included
+//
+std::vector<Token> Lex::tokenize() {
+    std::vector<Token> tokens;
+    tokens.reserve((end - pos) / 4);
+    
+    Token token = getNext();
+    while (token.type != Eof) {
+        tokens.push_back(token);
+        token = getNext();
+    }
+    
+    return tokens;
+}
+
 //
 // Utility helper functions
 //
@@ -107,132 +287,6 @@ bool Lex::isSymbol(char c) {
     return false;
 }
 
-bool Lex::isKeyword() {
-    if (buffer == "nop") return true;
-    else if (buffer == "hlt") return true;
-    else if (buffer == "ecall") return true;
-    
-    else if (buffer == "add") return true;
-    else if (buffer == "sub") return true;
-    else if (buffer == "sll") return true;
-    else if (buffer == "slt") return true;
-    else if (buffer == "sltu") return true;
-    else if (buffer == "xor") return true;
-    else if (buffer == "srl") return true;
-    else if (buffer == "sra") return true;
-    else if (buffer == "or") return true;
-    else if (buffer == "and") return true;
-    
-    else if (buffer == "addi") return true;
-    else if (buffer == "slli") return true;
-    else if (buffer == "slti") return true;
-    else if (buffer == "sltiu") return true;
-    else if (buffer == "xori") return true;
-    else if (buffer == "srli") return true;
-    else if (buffer == "srai") return true;
-    else if (buffer == "ori") return true;
-    else if (buffer == "andi") return true;
-    
-    else if (buffer == "lb") return true;
-    else if (buffer == "lh") return true;
-    else if (buffer == "lw") return true;
-    else if (buffer == "lbu") return true;
-    else if (buffer == "lhu") return true;
-    
-    else if (buffer == "sb") return true;
-    else if (buffer == "sh") return true;
-    else if (buffer == "sw") return true;
-    
-    else if (buffer == "beq") return true;
-    else if (buffer == "bne") return true;
-    else if (buffer == "blt") return true;
-    else if (buffer == "bge") return true;
-    else if (buffer == "bltu") return true;
-    else if (buffer == "bgeu") return true;
-    
-    else if (buffer == "lui") return true;
-    else if (buffer == "auipc") return true;
-    else if (buffer == "jal") return true;
-    else if (buffer == "jalr") return true;
-    
-    else if (buffer == "flw") return true;
-    else if (buffer == "fsw") return true;
-    else if (buffer == "fadd.s") return true;
-    else if (buffer == "fsub.s") return true;
-    
-    else if (buffer == "x0") return true;
-    else if (buffer == "x1") return true;
-    else if (buffer == "x2") return true;
-    else if (buffer == "x3") return true;
-    else if (buffer == "x4") return true;
-    else if (buffer == "x5") return true;
-    else if (buffer == "x6") return true;
-    else if (buffer == "x7") return true;
-    else if (buffer == "x8") return true;
-    else if (buffer == "x9") return true;
-    else if (buffer == "x10") return true;
-    else if (buffer == "x11") return true;
-    else if (buffer == "x12") return true;
-    else if (buffer == "x13") return true;
-    else if (buffer == "x14") return true;
-    else if (buffer == "x15") return true;
-    else if (buffer == "x16") return true;
-    else if (buffer == "x17") return true;
-    else if (buffer == "x18") return true;
-    else if (buffer == "x19") return true;
-    else if (buffer == "x20") return true;
-    else if (buffer == "x21") return true;
-    else if (buffer == "x22") return true;
-    else if (buffer == "x23") return true;
-    else if (buffer == "x24") return true;
-    else if (buffer == "x25") return true;
-    else if (buffer == "x26") return true;
-    else if (buffer == "x27") return true;
-    else if (buffer == "x28") return true;
-    else if (buffer == "x29") return true;
-    else if (buffer == "x30") return true;
-    else if (buffer == "x31") return true;
-    
-    else if (buffer == "bp") return true;
-    else if (buffer == "ra") return true;
-    else if (buffer == "sp") return true;
-    
-    else if (buffer == "f0") return true;
-    else if (buffer == "f1") return true;
-    else if (buffer == "f2") return true;
-    else if (buffer == "f3") return true;
-    else if (buffer == "f4") return true;
-    else if (buffer == "f5") return true;
-    else if (buffer == "f6") return true;
-    else if (buffer == "f7") return true;
-    else if (buffer == "f8") return true;
-    else if (buffer == "f9") return true;
-    else if (buffer == "f10") return true;
-    else if (buffer == "f11") return true;
-    else if (buffer == "f12") return true;
-    else if (buffer == "f13") return true;
-    else if (buffer == "f14") return true;
-    else if (buffer == "f15") return true;
-    else if (buffer == "f16") return true;
-    else if (buffer == "f17") return true;
-    else if (buffer == "f18") return true;
-    else if (buffer == "f19") return true;
-    else if (buffer == "f20") return true;
-    else if (buffer == "f21") return true;
-    else if (buffer == "f22") return true;
-    else if (buffer == "f23") return true;
-    else if (buffer == "f24") return true;
-    else if (buffer == "f25") return true;
-    else if (buffer == "f26") return true;
-    else if (buffer == "f27") return true;
-    else if (buffer == "f28") return true;
-    else if (buffer == "f29") return true;
-    else if (buffer == "f30") return true;
-    else if (buffer == "f31") return true;
-    
-    return false;
-}
-
 bool Lex::isInt() {
     for (char c : buffer) {
         if (c == '-') continue;
@@ -241,6 +295,16 @@ bool Lex::isInt() {
     return true;
 }
 
+//
+// Converts the buffer to an integer
+// Like stoi(), parsing stops at the first character that is not a digit
+//
+int Lex::getInt() {
+    int value = 0;
+    std::from_chars(buffer.data(), buffer.data() + buffer.length(), value);
+    return value;
+}
+
 TokenType Lex::getSymbol(char c) {
     switch (c) {
         case '\n': return Nl;
@@ -254,136 +318,28 @@ TokenType Lex::getSymbol(char c) {
     return None;
 }
 
+//
+// Looks up the buffer in the keyword table
+// Returns None if the buffer is not a keyword
+//
 TokenType Lex::getKeyword() {
-    if (buffer == "nop") return Nop;
-    else if (buffer == "hlt") return Hlt;
-    else if (buffer == "ecall") return Ecall;
-    
-    else if (buffer == "add") return Add;
-    else if (buffer == "sub") return Sub;
-    else if (buffer == "sll") return Sll;
-    else if (buffer == "slt") return Slt;
-    else if (buffer == "sltu") return Sltu;
-    else if (buffer == "xor") return Xor;
-    else if (buffer == "srl") return Srl;
-    else if (buffer == "sra") return Sra;
-    else if (buffer == "or") return Or;
-    else if (buffer == "and") return And;
-    
-    else if (buffer == "addi") return Addi;
-    else if (buffer == "slli") return Slli;
-    else if (buffer == "slti") return Slti;
-    else if (buffer == "sltiu") return Sltiu;
-    else if (buffer == "xori") return Xori;
-    else if (buffer == "srli") return Srli;
-    else if (buffer == "srai") return Srai;
-    else if (buffer == "ori") return Ori;
-    else if (buffer == "andi") return Andi;
-    
-    else if (buffer == "lb") return Lb;
-    else if (buffer == "lh") return Lh;
-    else if (buffer == "lw") return Lw;
-    else if (buffer == "lbu") return Lbu;
-    else if (buffer == "lhu") return Lhu;
-    
-    else if (buffer == "sb") return Sb;
-    else if (buffer == "sh") return Sh;
-    else if (buffer == "sw") return Sw;
+    size_t length = buffer.length();
+    if (length == 0 || length > 8) return None;
     
-    else if (buffer == "beq") return Beq;
-    else if (buffer == "bne") return Bne;
-    else if (buffer == "blt") return Blt;
-    else if (buffer == "bge") return Bge;
-    else if (buffer == "bltu") return Bltu;
-    else if (buffer == "bgeu") return Bgeu;
-    
-    else if (buffer == "lui") return Lui;
-    else if (buffer == "auipc") return Auipc;
-    else if (buffer == "jal") return Jal;
-    else if (buffer == "jalr") return Jalr;
-    
-    else if (buffer == "flw") return Flw;
-    else if (buffer == "fsw") return Fsw;
-    else if (buffer == "fadd.s") return Fadds;
-    else if (buffer == "fsub.s") return Fsubs;
-    
-    else if (buffer == "x0") return X0;
-    else if (buffer == "x1") return X1;
-    else if (buffer == "x2") return X2;
-    else if (buffer == "x3") return X3;
-    else if (buffer == "x4") return X4;
-    else if (buffer == "x5") return X5;
-    else if (buffer == "x6") return X6;
-    else if (buffer == "x7") return X7;
-    else if (buffer == "x8") return X8;
-    else if (buffer == "x9") return X9;
-    else if (buffer == "x10") return X10;
-    else if (buffer == "x11") return X11;
-    else if (buffer == "x12") return X12;
-    else if (buffer == "x13") return X13;
-    else if (buffer == "x14") return X14;
-    else if (buffer == "x15") return X15;
-    else if (buffer == "x16") return X16;
-    else if (buffer == "x17") return X17;
-    else if (buffer == "x18") return X18;
-    else if (buffer == "x19") return X19;
-    else if (buffer == "x20") return X20;
-    else if (buffer == "x21") return X21;
-    else if (buffer == "x22") return X22;
-    else if (buffer == "x23") return X23;
-    else if (buffer == "x24") return X24;
-    else if (buffer == "x25") return X25;
-    else if (buffer == "x26") return X26;
-    else if (buffer == "x27") return X27;
-    else if (buffer == "x28") return X28;
-    else if (buffer == "x29") return X29;
-    else if (buffer == "x30") return X30;
-    else if (buffer == "x31") return X31;
-    
-    else if (buffer == "bp") return Bp;
-    else if (buffer == "ra") return Ra;
-    else if (buffer == "sp") return Sp;
-    
-    else if (buffer == "f0") return F0;
-    else if (buffer == "f1") return F1;
-    else if (buffer == "f2") return F2;
-    else if (buffer == "f3") return F3;
-    else if (buffer == "f4") return F4;
-    else if (buffer == "f5") return F5;
-    else if (buffer == "f6") return F6;
-    else if (buffer == "f7") return F7;
-    else if (buffer == "f8") return F8;
-    else if (buffer == "f9") return F9;
-    else if (buffer == "f10") return F10;
-    else if (buffer == "f11") return F11;
-    else if (buffer == "f12") return F12;
-    else if (buffer == "f13") return F13;
-    else if (buffer == "f14") return F14;
-    else if (buffer == "f15") return F15;
-    else if (buffer == "f16") return F16;
-    else if (buffer == "f17") return F17;
-    else if (buffer == "f18") return F18;
-    else if (buffer == "f19") return F19;
-    else if (buffer == "f20") return F20;
-    else if (buffer == "f21") return F21;
-    else if (buffer == "f22") return F22;
-    else if (buffer == "f23") return F23;
-    else if (buffer == "f24") return F24;
-    else if (buffer == "f25") return F25;
-    else if (buffer == "f26") return F26;
-    else if (buffer == "f27") return F27;
-    else if (buffer == "f28") return F28;
-    else if (buffer == "f29") return F29;
-    else if (buffer == "f30") return F30;
-    else if (buffer == "f31") return F31;
+    uint64_t key = 0;
+    for (size_t i = 0; i<length; i++) {
+        key |= (uint64_t)(uint8_t)buffer[i] << (i * 8);
+    }
     
-    return None;
+    size_t slot = keywordSlot(key);
+    if (keywordTable.keys[slot] != key) return None;
+    return (TokenType)keywordTable.types[slot];
 }
 
 //
 // The debug function for tokens
 //
-void Token::print() {
+void Token::print() const {
     switch (type) {
         case Eof: std::cout << "EOF "; break;
         case Nop: std::cout << "nop "; break;
@@ -1,13 +1,20 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "symtab.hpp"
+#include "mapfile.hpp"
+#include "scan.hpp"
 #include <fstream>
-#include <stack>
+#include <vector>
 
 //
 // Defines RISC-V tokens
 //
-enum TokenType {
+enum TokenType : uint8_t {
     None,
     Eof,
     Nop,
@@ -74,32 +81,79 @@ enum TokenType {
 
 //
 // Holds information on each token
+// Tokens are small and trivially copyable so they can be passed and stored
+// by value without touching the heap. The id is a slice of the source text,
+// so it is only valid while the scanner that produced it is alive.
 //
 struct Token {
     TokenType type = None;
-    int imm = 0;
-    std::string id = "";
+    union {
+        int imm = 0;    // Imm tokens
+        int sym;        // Id tokens: the symbol id, or -1 without a symbol table
+    };
+    std::string_view id;
     
-    void print();
+    void print() const;
 };
 
+static_assert(std::is_trivially_copyable<Token>::value, "Token must stay trivially copyable.");
+static_assert(sizeof(Token) <= 24, "Token should fit in 24 bytes.");
+
 //
 // The scanner class
+// A file is read through a MappedFile and scanned in place.
+//
+// A scanner can also replay a buffer of tokens produced by tokenize(), so
+// the source is only lexed once no matter how many passes read it.
+//
+// A scanner over a std::istream (such as stdin) keeps only a small window
+// of the input in memory. The window always holds the whole current line;
+// when it moves on, the ids of earlier tokens are no longer valid, so they
+// must be used before the next line is read.
 //
 class Lex {
 public:
     explicit Lex(std::string input);
+    explicit Lex(const char *source, size_t length);
+    explicit Lex(const Token *begin, const Token *end);
+    explicit Lex(std::istream *stream);
+    ~Lex();
     Token getNext();
+    void setSymbols(SymbolTable *symbols) { this->symbols = symbols; }
+    void setScanLevel(ScanLevel level) { scanner = &getScanner(level); }
+    
+    bool isOpen() const { return !failed; }
+    std::string_view getText() const { return std::string_view(pos, end - pos); }
+    bool hasOpenString() const { return openString; }
+    std::vector<Token> tokenize();
 private:
-    std::ifstream reader;
-    std::string buffer = "";
-    std::stack<Token> stack;
+    const char *pos = nullptr;
+    const char *end = nullptr;
+    std::string_view buffer;
+    SymbolTable *symbols = nullptr;
+    const Scanner *scanner = &getScanner(getBestScanLevel());
+    bool openString = false;        // A string ran into the end of the input
+    bool failed = false;            // The input could not be opened
+    
+    // Token replay
+    const Token *next = nullptr;
+    const Token *last = nullptr;
+    
+    // File input
+    MappedFile *file = nullptr;
+    
+    // Streaming input
+    std::string data = "";
+    std::istream *stream = nullptr;
+    const char *lineEnd = nullptr;
+    
+    void fillLine();
+    bool refill(const char *&keep);
     
     bool isSymbol(char c);
-    bool isKeyword();
     bool isInt();
+    int getInt();
     
     TokenType getSymbol(char c);
     TokenType getKeyword();
 };
-
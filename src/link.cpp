@@ -0,0 +1,117 @@
+#include <sstream>
+#include <cstring>
+
+#include "link.hpp"
+#include "isa.hpp"
+#include "symtab.hpp"
+#include "pool.hpp"
+
+static bool isLocal(const std::string &name) {
+    return name.compare(0, 2, ".L") == 0;
+}
+
+//
+// Patches the relocations of one image
+// Each image only writes to its own bytes and reads the shared table, so
+// images can be relocated in parallel.
+//
+static void relocate(LinkInput &input, int base, const SymbolTable &globals, std::ostream &errors) {
+    Image &image = input.image;
+    for (const Reloc &reloc : image.relocs) {
+        const ImageSymbol &symbol = image.symbols[reloc.sym];
+        
+        int address;
+        if (symbol.defined && isLocal(symbol.name)) {
+            address = base + symbol.address;
+        } else {
+            int id = globals.find(symbol.name);
+            if (id == -1 || !globals.isDefined(id)) {
+                errors << "Error: Undefined label \'" << symbol.name << "\' in " << input.name << "." << std::endl;
+                continue;
+            }
+            address = globals.getAddress(id);
+        }
+        
+        // Objects are not relaxed across inputs, so a branch or jal to
+        // another input has to reach it as it is
+        int pc = base + (int)reloc.offset;
+        bool inRange = reloc.type == RelocBranch ? fitsBranch(address - pc)
+            : reloc.type != RelocJal || fitsJal(address - pc);
+        if (!inRange) {
+            errors << "Error: Label \'" << symbol.name << "\' is out of range in " << input.name << "." << std::endl;
+            continue;
+        }
+        
+        // The field of a relocated instruction is zero, so it is ORed in
+        uint32_t instr;
+        memcpy(&instr, &image.bytes[reloc.offset], sizeof(uint32_t));
+        
+        switch (reloc.type) {
+            case RelocBranch: instr |= encodeBranch(address - pc); break;
+            case RelocJal: instr |= encodeJal(address - pc); break;
+            case RelocHi20: instr |= (((uint32_t)address + 0x800) >> 12) << 12; break;
+            case RelocLo12: instr |= (uint32_t)(address & 0xFFF) << 20; break;
+        }
+        
+        memcpy(&image.bytes[reloc.offset], &instr, sizeof(uint32_t));
+    }
+    
+    image.relocs.clear();
+}
+
+//
+// Links the images into one flat image
+// Returns false if a label was undefined or defined twice.
+//
+bool link(std::vector<LinkInput> &inputs, unsigned jobs, Image &output, std::ostream &errors) {
+    // Lay the images out and merge their global labels
+    // Every image but the last is padded to a whole number of words
+    SymbolTable *globals = new SymbolTable;
+    std::vector<size_t> owner;          // Input that defined each global
+    std::vector<int> bases(inputs.size());
+    bool ok = true;
+    
+    int lc = 0;
+    for (size_t i = 0; i<inputs.size(); i++) {
+        bases[i] = lc;
+        lc += ((int)inputs[i].image.bytes.size() + 3) & ~3;
+        
+        for (const ImageSymbol &symbol : inputs[i].image.symbols) {
+            if (!symbol.defined || isLocal(symbol.name)) continue;
+            
+            int id = globals->intern(symbol.name);
+            if (globals->isDefined(id)) {
+                errors << "Error: Label \'" << symbol.name << "\' is defined in both " << inputs[owner[id]].name
+                    << " and " << inputs[i].name << "." << std::endl;
+                ok = false;
+                continue;
+            }
+            
+            globals->define(id, bases[i] + symbol.address);
+            owner.resize(globals->size());
+            owner[id] = i;
+        }
+    }
+    
+    // Relocate every image at once; diagnostics are kept per image so they
+    // come out in input order
+    std::vector<std::ostringstream> messages(inputs.size());
+    WorkPool *pool = new WorkPool(jobs);
+    pool->run(inputs.size(), [&](size_t i) {
+        relocate(inputs[i], bases[i], *globals, messages[i]);
+    });
+    delete pool;
+    
+    output.bytes.reserve(lc);
+    for (size_t i = 0; i<inputs.size(); i++) {
+        output.bytes.resize(bases[i], 0);
+        output.append(inputs[i].image);
+        
+        std::string text = messages[i].str();
+        if (!text.empty()) ok = false;
+        errors << text;
+    }
+    
+    delete globals;
+    return ok;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "output.hpp"
+
+//
+// The linker
+// Relocatable images are laid out back to back in input order, each one
+// starting on a word boundary, and their relocations are applied against
+// the merged labels. Labels starting with ".L" stay local to their image;
+// a global label defined by two images is an error.
+//
+struct LinkInput {
+    std::string name;       // For diagnostics
+    Image image;
+};
+
+bool link(std::vector<LinkInput> &inputs, unsigned jobs, Image &output, std::ostream &errors);
@@ -1,9 +1,202 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
-#include <map>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
 
-#include "pass1.hpp"
-#include "pass2.hpp"
+#include "mapfile.hpp"
+#include "assemble.hpp"
+#include "output.hpp"
+#include "pool.hpp"
+#include "server.hpp"
+#include "cache.hpp"
+#include "link.hpp"
+#include "alloc.hpp"
+
+//
+// One input of a batch
+// Each job keeps its own diagnostics so they can be printed together once
+// the whole batch is done.
+//
+struct BatchJob {
+    std::string input;
+    std::string output;
+    std::ostringstream errors;
+    size_t sourceBytes = 0;
+    size_t imageBytes = 0;
+};
+
+//
+// Names the output of a batch input: the input with its extension
+// replaced by .bin, placed in dir if one is given
+// (.out would clobber the golden files next to the test sources.)
+//
+static std::string batchOutput(const std::string &input, const std::string &dir) {
+    std::string name = input;
+    size_t slash = name.rfind('/');
+    size_t dot = name.rfind('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        name.erase(dot);
+    }
+    name += ".bin";
+    
+    if (dir.empty()) return name;
+    if (slash != std::string::npos) name.erase(0, slash + 1);
+    return dir + "/" + name;
+}
+
+//
+// Adds every path listed in a manifest, one per line
+//
+static bool readManifest(const std::string &path, std::vector<std::string> &inputs) {
+    std::ifstream manifest(path);
+    if (!manifest.is_open()) return false;
+    
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (!line.empty()) inputs.push_back(line);
+    }
+    return true;
+}
+
+//
+// Assembles one batch input on the calling thread
+//
+static void assembleJob(BatchJob *job, Format format) {
+    MappedFile *source = new MappedFile(job->input);
+    if (!source->isOpen()) {
+        job->errors << "Error: Unable to open " << job->input << "." << std::endl;
+        delete source;
+        return;
+    }
+    
+    job->sourceBytes = source->getText().length();
+    AssembleOptions options;
+    options.relocatable = format == FormatElf32 || format == FormatElf64;
+    Assembly result = assemble(source->getText(), options);
+    job->errors << result.errors;
+    
+    // An image with errors in it is not written
+    if (!result.ok()) {
+        delete source;
+        return;
+    }
+    job->imageBytes = result.image.bytes.size();
+    reportWrite(writeOutput(result.image, format, job->output), job->output, job->errors);
+    
+    delete source;
+}
+
+//
+// Assembles every input on a shared pool of threads
+// Diagnostics are printed per input, prefixed with its name, followed by
+// the throughput of the whole batch. Returns the exit status.
+//
+static int runBatch(const std::vector<std::string> &inputs, const std::string &dir, Format format, unsigned jobs) {
+    std::vector<BatchJob> batch(inputs.size());
+    for (size_t i = 0; i<inputs.size(); i++) {
+        batch[i].input = inputs[i];
+        batch[i].output = batchOutput(inputs[i], dir);
+    }
+    
+    // Two inputs with the same name would write one output from two
+    // threads at once
+    std::unordered_map<std::string, size_t> owners;
+    for (size_t i = 0; i<batch.size(); i++) {
+        auto inserted = owners.emplace(batch[i].output, i);
+        if (!inserted.second) {
+            std::cerr << "Error: " << batch[inserted.first->second].input << " and " << batch[i].input
+                << " would both be written to " << batch[i].output << "." << std::endl;
+            return 1;
+        }
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    WorkPool *pool = new WorkPool(jobs);
+    pool->run(batch.size(), [&](size_t i) {
+        assembleJob(&batch[i], format);
+    });
+    delete pool;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    size_t failed = 0;
+    size_t sourceBytes = 0;
+    size_t imageBytes = 0;
+    for (BatchJob &job : batch) {
+        sourceBytes += job.sourceBytes;
+        imageBytes += job.imageBytes;
+        
+        std::string errors = job.errors.str();
+        if (errors.empty()) continue;
+        ++failed;
+        
+        std::istringstream lines(errors);
+        std::string line;
+        while (std::getline(lines, line)) {
+            std::cerr << job.input << ": " << line << "\n";
+        }
+    }
+    
+    double seconds = elapsed.count() > 0 ? elapsed.count() : 1e-9;
+    std::cerr << "Assembled " << batch.size() - failed << "/" << batch.size() << " files, "
+        << sourceBytes << " bytes of source into " << imageBytes << " bytes in "
+        << seconds << " s (" << batch.size() / seconds << " files/s, "
+        << sourceBytes / seconds / 1e6 << " MB/s)" << std::endl;
+    
+    return failed == 0 ? 0 : 1;
+}
+
+//
+// Assembles every input as a relocatable image on a shared pool of
+// threads, then links them into one image
+// Returns the exit status.
+//
+static int runLink(const std::vector<std::string> &inputs, const std::string &output, Format format, unsigned jobs) {
+    std::vector<LinkInput> objects(inputs.size());
+    std::vector<std::string> messages(inputs.size());
+    
+    WorkPool *pool = new WorkPool(jobs);
+    pool->run(inputs.size(), [&](size_t i) {
+        objects[i].name = inputs[i];
+        MappedFile *source = new MappedFile(inputs[i]);
+        if (!source->isOpen()) {
+            messages[i] = "Error: Unable to open " + inputs[i] + ".\n";
+            delete source;
+            return;
+        }
+        
+        AssembleOptions options;
+        options.relocatable = true;
+        Assembly result = assemble(source->getText(), options);
+        objects[i].image = std::move(result.image);
+        messages[i] = result.errors;
+        delete source;
+    });
+    delete pool;
+    
+    bool ok = true;
+    for (size_t i = 0; i<inputs.size(); i++) {
+        if (messages[i].empty()) continue;
+        ok = false;
+        
+        std::istringstream lines(messages[i]);
+        std::string line;
+        while (std::getline(lines, line)) {
+            std::cerr << inputs[i] << ": " << line << "\n";
+        }
+    }
+    if (!ok) return 1;
+    
+    Image image;
+    if (!link(objects, jobs, image, std::cerr)) return 1;
+    
+    WriteResult write = writeOutput(image, format, output);
+    reportWrite(write, output, std::cerr);
+    return write == WriteOk ? 0 : 1;
+}
 
 int main(int argc, char **argv) {
     if (argc == 1) {
@@ -18,28 +211,161 @@ int main(int argc, char **argv) {
     }*/
     std::string input = "";
     std::string output = "out";
-    std::string format = "default";
+    std::string formatName = "default";
+    bool singlePass = false;
+    bool batch = false;
+    bool linking = false;
+    bool stats = false;
+    bool statsJson = false;
+    std::string socket = "";
+    std::string cache = "";
+    bool outputSet = false;
+    std::vector<std::string> inputs;
+    unsigned jobs = std::thread::hardware_concurrency();
     for (int i = 1; i<argc; i++) {
-        if (std::string(argv[i]) == "-f") {
-            format = std::string(argv[i+1]);
+        std::string arg = argv[i];
+        bool takesValue = arg == "--serve" || arg == "--cache" || arg == "-j" || arg == "-f" || arg == "-o";
+        if (takesValue && i + 1 >= argc) {
+            std::cerr << "Error: " << arg << " needs a value." << std::endl;
+            return 1;
+        }
+        
+        if (arg == "--single-pass") {
+            singlePass = true;
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--link") {
+            linking = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--stats=json") {
+            stats = true;
+            statsJson = true;
+        } else if (arg == "--serve") {
+            socket = std::string(argv[i+1]);
+            ++i;
+        } else if (arg == "--cache") {
+            cache = std::string(argv[i+1]);
             ++i;
-        } else if (std::string(argv[i]) == "-o") {
+        } else if (arg == "-j") {
+            if (!parseJobs(argv[i+1], jobs)) {
+                std::cerr << "Error: -j needs a positive number of threads, not " << argv[i+1] << "." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "-f") {
+            formatName = std::string(argv[i+1]);
+            ++i;
+        } else if (arg == "-o") {
             output = std::string(argv[i+1]);
+            outputSet = true;
             ++i;
+        } else if (argv[i][0] == '@') {
+            if (!readManifest(argv[i] + 1, inputs)) {
+                std::cerr << "Error: Unable to open " << argv[i] + 1 << "." << std::endl;
+                return 1;
+            }
         } else {
             input = argv[i];
+            inputs.push_back(input);
         }
     }
     
-    Pass1 *pass1 = new Pass1(input);
-    std::map<std::string, int> labels = pass1->run();
+    // The report covers one assembly; the other modes run many, or patch
+    if (stats && (batch || linking || !cache.empty() || !socket.empty())) {
+        std::cerr << "Error: --stats cannot be used with --batch, --link, --cache or --serve." << std::endl;
+        return 1;
+    }
     
-    Pass2 *pass2 = new Pass2(input, output);
-    pass2->setMap(labels);
-    pass2->setFormat(format);
-    pass2->run();
-    delete pass2;
-
-    return 0;
+    // The cache patches one flat binary assembled in two passes from a file
+    bool cacheable = !singlePass && formatName == "default" && input != "-";
+    if (!cache.empty() && (!cacheable || batch || linking || !socket.empty())) {
+        std::cerr << "Error: --cache only works on one input file, in two-pass mode, with the default format." << std::endl;
+        return 1;
+    }
+    
+    if (!socket.empty()) {
+        return serve(socket, jobs);
+    }
+    
+    Format format;
+    if (!getFormat(formatName, format)) {
+        std::cerr << "Error: Unknown output format " << formatName << "." << std::endl;
+        return 1;
+    }
+    
+    if (linking) {
+        return runLink(inputs, output, format, jobs);
+    }
+    
+    // In batch mode -o names a directory for the outputs
+    if (batch) {
+        return runBatch(inputs, outputSet ? output : "", format, jobs);
+    }
+    
+    // Standard input can only be read once, so it is streamed in a single
+    // pass; files are mapped and assembled in place
+    AssembleOptions options;
+    options.singlePass = singlePass;
+    options.jobs = jobs;
+    options.relocatable = format == FormatElf32 || format == FormatElf64;
+    
+    // Allocations are counted from here, so argument parsing is left out
+    Stats *report = nullptr;
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+    if (stats) {
+        report = new Stats;
+        options.stats = report;
+        getAllocations(allocations, allocatedBytes);
+    }
+    
+    Assembly result;
+    MappedFile *source = nullptr;
+    if (input == "-") {
+        result = assemble(&std::cin, options);
+    } else {
+        source = new MappedFile(input);
+        if (!source->isOpen()) {
+            std::cerr << "Error: Unable to open " << input << "." << std::endl;
+            return 1;
+        }
+        
+        if (!cache.empty()) {
+            CacheStats stats;
+            std::ostringstream errors;
+            bool written = assembleCached(source->getText(), output, cache, jobs, errors, stats);
+            std::cerr << errors.str();
+            delete source;
+            return written && errors.str().empty() ? 0 : 1;
+        }
+        
+        result = assemble(source->getText(), options);
+    }
+    
+    // An image with errors in it is not written
+    std::cerr << result.errors;
+    PhaseTimer timer(report);
+    size_t written = 0;
+    bool ok = result.ok();
+    if (ok) {
+        WriteResult write = writeOutput(result.image, format, output, &written);
+        reportWrite(write, output, std::cerr);
+        ok = write == WriteOk;
+    }
+    timer.lap(PhaseWrite);
+    
+    if (report) {
+        size_t count, bytes;
+        getAllocations(count, bytes);
+        report->allocations = count - allocations;
+        report->allocatedBytes = bytes - allocatedBytes;
+        report->bytesOut = written;
+        report->peakRss = getPeakRss();
+        report->print(std::cerr, statsJson);
+        delete report;
+    }
+    
+    delete source;
+    return ok ? 0 : 1;
 }
-
@@ -0,0 +1,60 @@
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapfile.hpp"
+
+//
+// Maps the file, or reads it if it cannot be mapped
+//
+MappedFile::MappedFile(const std::string &path) {
+    if (openMap(path)) return;
+    
+    std::ifstream reader(path, std::ios::binary);
+    if (!reader.is_open()) {
+        failed = true;
+        return;
+    }
+    
+    data.assign(std::istreambuf_iterator<char>(reader), std::istreambuf_iterator<char>());
+    text = data;
+}
+
+MappedFile::~MappedFile() {
+    if (map) munmap(map, mapSize);
+}
+
+//
+// Maps the file if it is a regular file
+// Returns false if the caller should fall back to reading the stream
+//
+bool MappedFile::openMap(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    
+    struct stat info;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return false;
+    }
+    
+    // mmap() refuses empty mappings, but an empty file is still valid input
+    if (info.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    
+    void *addr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+    
+    madvise(addr, info.st_size, MADV_SEQUENTIAL);
+    
+    map = addr;
+    mapSize = info.st_size;
+    text = std::string_view((const char *)addr, mapSize);
+    return true;
+}
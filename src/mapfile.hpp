@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+//
+// The contents of a file, read-only
+// Regular files are memory-mapped and unmapped again when the object is
+// deleted. Anything else (pipes, devices) is read into an owned buffer.
+//
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    
+    bool isOpen() const { return !failed; }
+    std::string_view getText() const { return text; }
+private:
+    std::string_view text;
+    bool failed = false;            // The file could not be opened
+    
+    // Memory-mapped input
+    void *map = nullptr;
+    size_t mapSize = 0;
+    
+    // Fallback input for non-regular files
+    std::string data = "";
+    
+    bool openMap(const std::string &path);
+};
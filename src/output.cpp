@@ -0,0 +1,334 @@
+#include <iostream>
+#include <cstring>
+#include <string_view>
+
+#include "output.hpp"
+#include "elf.hpp"
+
+// The size of the output buffer
+constexpr size_t SINK_BUFFER = 1 << 20;
+
+// The most instructions formatted per reserve()
+constexpr size_t FORMAT_BATCH = 4096;
+
+bool getFormat(std::string name, Format &format) {
+    if (name == "default") format = FormatBinary;
+    else if (name == "string") format = FormatString;
+    else if (name == "hex") format = FormatHex;
+    else if (name == "readmemh") format = FormatReadmemh;
+    else if (name == "readmemb") format = FormatReadmemb;
+    else if (name == "coe") format = FormatCoe;
+    else if (name == "elf32") format = FormatElf32;
+    else if (name == "elf64") format = FormatElf64;
+    else return false;
+    return true;
+}
+
+//
+// Appends another image, which was assembled to follow this one
+//
+void Image::append(const Image &other) {
+    size_t offset = bytes.size();
+    bytes.insert(bytes.end(), other.bytes.begin(), other.bytes.end());
+    for (auto range : other.data) {
+        data.push_back({ range.first + offset, range.second });
+    }
+    for (Reloc reloc : other.relocs) {
+        reloc.offset += offset;
+        relocs.push_back(reloc);
+    }
+}
+
+//
+// The sink
+//
+Sink::Sink(FILE *file) {
+    this->file = file;
+    buffer.resize(SINK_BUFFER);
+}
+
+Sink::~Sink() {
+    flush();
+}
+
+void Sink::write(const void *data, size_t length) {
+    if (used + length > buffer.size()) flush();
+    
+    // Anything bigger than the buffer goes straight to the file
+    if (length >= buffer.size()) {
+        if (fwrite(data, 1, length, file) != length) failed = true;
+        written += length;
+        return;
+    }
+    
+    memcpy(&buffer[used], data, length);
+    used += length;
+}
+
+//
+// Returns room for length bytes at the end of the buffer
+// The caller fills in what it needs and then calls commit()
+//
+char *Sink::reserve(size_t length) {
+    if (used + length > buffer.size()) flush();
+    if (length > buffer.size()) buffer.resize(length);
+    return &buffer[used];
+}
+
+void Sink::flush() {
+    if (used && fwrite(buffer.data(), 1, used, file) != used) failed = true;
+    written += used;
+    used = 0;
+}
+
+//
+// Digit tables
+// Each byte of an instruction is turned into text with a single lookup and
+// a fixed-size copy, instead of one character at a time.
+//
+struct DigitTables {
+    char bits[256][8] = {};
+    char hex[256][2] = {};
+    
+    constexpr DigitTables() {
+        const char *digits = "0123456789abcdef";
+        for (int b = 0; b<256; b++) {
+            for (int i = 0; i<8; i++) {
+                bits[b][i] = (char)('0' + ((b >> (7 - i)) & 1));
+            }
+            hex[b][0] = digits[b >> 4];
+            hex[b][1] = digits[b & 0xF];
+        }
+    }
+};
+
+static constexpr DigitTables digitTables;
+
+static inline void formatBits(char *out, uint32_t instr) {
+    memcpy(out + 0, digitTables.bits[(instr >> 24) & 0xFF], 8);
+    memcpy(out + 8, digitTables.bits[(instr >> 16) & 0xFF], 8);
+    memcpy(out + 16, digitTables.bits[(instr >> 8) & 0xFF], 8);
+    memcpy(out + 24, digitTables.bits[instr & 0xFF], 8);
+}
+
+static inline void formatHex(char *out, uint32_t instr) {
+    memcpy(out + 0, digitTables.hex[(instr >> 24) & 0xFF], 2);
+    memcpy(out + 2, digitTables.hex[(instr >> 16) & 0xFF], 2);
+    memcpy(out + 4, digitTables.hex[(instr >> 8) & 0xFF], 2);
+    memcpy(out + 6, digitTables.hex[instr & 0xFF], 2);
+}
+
+//
+// The per-format instruction formatters
+// Each one writes a fixed number of bytes per instruction. The string
+// format copies strings through untouched; the memory formats instead dump
+// the whole image as little-endian words, as it would be loaded.
+//
+template<Format F>
+struct Formatter;
+
+template<>
+struct Formatter<FormatBinary> {
+    static constexpr size_t width = 4;
+    static constexpr bool words = false;
+    
+    static void word(char *out, uint32_t instr) {
+        memcpy(out, &instr, sizeof(uint32_t));
+    }
+};
+
+template<>
+struct Formatter<FormatString> {
+    static constexpr size_t width = 33;
+    static constexpr bool words = false;
+    
+    static void word(char *out, uint32_t instr) {
+        formatBits(out, instr);
+        out[32] = '\n';
+    }
+};
+
+template<>
+struct Formatter<FormatHex> {
+    static constexpr size_t width = 9;
+    static constexpr bool words = true;
+    static constexpr const char *header = "";
+    static constexpr const char *footer = "";
+    static constexpr size_t trim = 0;
+    
+    static void word(char *out, uint32_t instr) {
+        formatHex(out, instr);
+        out[8] = '\n';
+    }
+};
+
+template<>
+struct Formatter<FormatReadmemh> : Formatter<FormatHex> {
+    static constexpr const char *header = "@00000000\n";
+};
+
+template<>
+struct Formatter<FormatReadmemb> {
+    static constexpr size_t width = 33;
+    static constexpr bool words = true;
+    static constexpr const char *header = "@00000000\n";
+    static constexpr const char *footer = "";
+    static constexpr size_t trim = 0;
+    
+    static void word(char *out, uint32_t instr) {
+        formatBits(out, instr);
+        out[32] = '\n';
+    }
+};
+
+// Every entry but the last is followed by ",\n"; the footer closes the list
+template<>
+struct Formatter<FormatCoe> {
+    static constexpr size_t width = 10;
+    static constexpr bool words = true;
+    static constexpr const char *header = "memory_initialization_radix=16;\nmemory_initialization_vector=\n";
+    static constexpr const char *footer = ";\n";
+    static constexpr size_t trim = 2;
+    
+    static void word(char *out, uint32_t instr) {
+        formatHex(out, instr);
+        out[8] = ',';
+        out[9] = '\n';
+    }
+};
+
+//
+// Formats a run of instructions
+//
+template<Format F>
+static void writeWords(const uint8_t *pos, size_t count, Sink &sink) {
+    if constexpr (F == FormatBinary) {
+        sink.write(pos, count * sizeof(uint32_t));
+        return;
+    }
+    
+    while (count > 0) {
+        size_t batch = count < FORMAT_BATCH ? count : FORMAT_BATCH;
+        char *out = sink.reserve(batch * Formatter<F>::width);
+        
+        for (size_t i = 0; i<batch; i++) {
+            uint32_t instr;
+            memcpy(&instr, pos, sizeof(uint32_t));
+            Formatter<F>::word(out, instr);
+            
+            pos += sizeof(uint32_t);
+            out += Formatter<F>::width;
+        }
+        
+        sink.commit(batch * Formatter<F>::width);
+        count -= batch;
+    }
+}
+
+//
+// Writes the whole image as words, padding the last one with zeros
+// The last word is formatted on its own so a format can drop its
+// separator before the footer closes the list.
+//
+template<Format F>
+static void writeMemory(const Image &image, Sink &sink) {
+    std::string_view header = Formatter<F>::header;
+    std::string_view footer = Formatter<F>::footer;
+    sink.write(header.data(), header.length());
+    
+    size_t size = image.bytes.size();
+    if (size > 0) {
+        size_t count = (size - 1) / sizeof(uint32_t);
+        writeWords<F>(image.bytes.data(), count, sink);
+        
+        uint32_t instr = 0;
+        memcpy(&instr, &image.bytes[count * sizeof(uint32_t)], size - count * sizeof(uint32_t));
+        
+        char last[Formatter<F>::width];
+        Formatter<F>::word(last, instr);
+        sink.write(last, Formatter<F>::width - Formatter<F>::trim);
+    }
+    
+    sink.write(footer.data(), footer.length());
+}
+
+//
+// Writes the image: instructions go through the formatter, strings are
+// copied through as they are
+//
+template<Format F>
+static void writeFormat(const Image &image, Sink &sink) {
+    if constexpr (Formatter<F>::words) {
+        writeMemory<F>(image, sink);
+        return;
+    }
+    
+    const uint8_t *bytes = image.bytes.data();
+    size_t offset = 0;
+    
+    for (size_t i = 0; i<=image.data.size(); i++) {
+        size_t stop = image.bytes.size();
+        if (i < image.data.size()) stop = image.data[i].first;
+        
+        writeWords<F>(bytes + offset, (stop - offset) / sizeof(uint32_t), sink);
+        offset = stop;
+        
+        if (i < image.data.size()) {
+            sink.write(bytes + offset, image.data[i].second);
+            offset += image.data[i].second;
+        }
+    }
+}
+
+void writeImage(const Image &image, Format format, Sink &sink) {
+    switch (format) {
+        case FormatBinary: writeFormat<FormatBinary>(image, sink); break;
+        case FormatString: writeFormat<FormatString>(image, sink); break;
+        case FormatHex: writeFormat<FormatHex>(image, sink); break;
+        case FormatReadmemh: writeFormat<FormatReadmemh>(image, sink); break;
+        case FormatReadmemb: writeFormat<FormatReadmemb>(image, sink); break;
+        case FormatCoe: writeFormat<FormatCoe>(image, sink); break;
+        case FormatElf32: writeElf<Elf32>(image, sink); break;
+        case FormatElf64: writeElf<Elf64>(image, sink); break;
+    }
+}
+
+//
+// Writes the image to a file, or to stdout if the name is "-"
+// A write is only complete once the stream has been flushed or closed
+// without an error, since stdio may hold back the last of the bytes.
+//
+WriteResult writeOutput(const Image &image, Format format, std::string output, size_t *written) {
+    FILE *file = stdout;
+    if (output != "-") {
+        file = fopen(output.c_str(), "wb");
+        if (!file) return WriteOpenFailed;
+    }
+    
+    Sink *sink = new Sink(file);
+    writeImage(image, format, *sink);
+    sink->flush();
+    bool failed = sink->hasFailed();
+    if (written) *written = sink->size();
+    delete sink;
+    
+    if (file == stdout) {
+        if (fflush(file) != 0 || ferror(file)) failed = true;
+    } else {
+        if (ferror(file)) failed = true;
+        if (fclose(file) != 0) failed = true;
+    }
+    return failed ? WriteFailed : WriteOk;
+}
+
+//
+// Prints why an output could not be written, if it could not
+//
+void reportWrite(WriteResult result, const std::string &output, std::ostream &errors) {
+    std::string name = output == "-" ? "standard output" : output;
+    if (result == WriteOpenFailed) {
+        errors << "Error: Unable to open " << name << "." << std::endl;
+    } else if (result == WriteFailed) {
+        errors << "Error: Unable to write " << name << "." << std::endl;
+    }
+}
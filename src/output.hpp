@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <utility>
+
+//
+// The output formats
+// The name is only looked at once; everything past the command line uses
+// the enum.
+//
+enum Format {
+    FormatBinary,       // "default": a flat binary
+    FormatString,       // "string": one base-2 instruction per line
+    FormatHex,          // "hex": one hex word per line
+    FormatReadmemh,     // "readmemh": Verilog $readmemh
+    FormatReadmemb,     // "readmemb": Verilog $readmemb
+    FormatCoe,          // "coe": Xilinx memory initialization file
+    FormatElf32,        // "elf32": ELF32 relocatable object
+    FormatElf64         // "elf64": ELF64 relocatable object
+};
+
+bool getFormat(std::string name, Format &format);
+
+//
+// A label reference left for the linker
+// Only relocatable images have them. The field of the instruction at
+// offset is left zero.
+//
+enum RelocType {
+    RelocBranch,        // B-Type offset
+    RelocJal,           // J-Type offset
+    RelocHi20,          // U-Type upper 20 bits of the address
+    RelocLo12           // I-Type lower 12 bits of the address
+};
+
+struct Reloc {
+    size_t offset;
+    int sym;            // Index into the image symbols
+    RelocType type;
+};
+
+struct ImageSymbol {
+    std::string name;
+    int address;
+    bool defined;
+};
+
+//
+// The assembled program
+// Instructions and strings are laid out back to back, exactly as they are
+// loaded. The data ranges mark where the strings are, so text formats can
+// copy them through instead of formatting them as instructions.
+//
+// A relocatable image also carries its labels and the references to
+// resolve at link time.
+//
+struct Image {
+    std::vector<uint8_t> bytes;
+    std::vector<std::pair<size_t, size_t>> data;    // (offset, length)
+    std::vector<Reloc> relocs;
+    std::vector<ImageSymbol> symbols;
+    
+    void append(const Image &other);
+};
+
+//
+// A buffered output file
+// Formatters write straight into the buffer through reserve()/commit(), so
+// there are no per-instruction stdio calls.
+//
+class Sink {
+public:
+    explicit Sink(FILE *file);
+    ~Sink();
+    
+    void write(const void *data, size_t length);
+    char *reserve(size_t length);
+    void commit(size_t length) { used += length; }
+    void flush();
+    
+    size_t size() const { return written + used; }
+    bool hasFailed() const { return failed; }
+private:
+    FILE *file;
+    bool failed = false;            // A write came up short
+    std::vector<char> buffer;
+    size_t used = 0;
+    size_t written = 0;
+};
+
+//
+// How writing an output went
+//
+enum WriteResult {
+    WriteOk,
+    WriteOpenFailed,    // The file could not be opened
+    WriteFailed         // It was opened, but not all of it was written
+};
+
+void writeImage(const Image &image, Format format, Sink &sink);
+WriteResult writeOutput(const Image &image, Format format, std::string output, size_t *written = nullptr);
+void reportWrite(WriteResult result, const std::string &output, std::ostream &errors);
@@ -3,41 +3,49 @@
 
 #include "pass1.hpp"
 
-Pass1::Pass1(std::string input) {
-    lex = new Lex(input);
+Pass1::Pass1(Lex *lex, SymbolTable *symbols) {
+    this->lex = lex;
+    this->symbols = symbols;
 }
 
-std::map<std::string, int> Pass1::run() {
-    std::map<std::string, int> labels;
-    int lc = 0;     // The location counter
+//
+// Finds the address of every label
+// lc is the location counter at the first token, so a run can start part
+// way into a program. Returns the location counter at the end.
+//
+int Pass1::run(int lc) {
     
     Token token = lex->getNext();
     while (token.type != Eof) {
         switch (token.type) {
             case Id: {
-                std::string label = token.id;
-                labels[label] = lc;
+                symbols->define(token.sym, lc);
                 
                 token = lex->getNext();
                 if (token.type != Colon) {
-                    std::cerr << "Error: Expected \':\' after label." << std::endl;
-                    return labels;
+                    *errors << "Error: Expected \':\' after label." << std::endl;
+                    return lc;
                 }
                 
                 token = lex->getNext();
                 if (token.type == String) {
-                    std::string s = token.id;
-                    for (char c : s) {
-                        ++lc;
-                    }
+                    std::string_view s = token.id;
+                    lc += s.length();
                 }
             }
             
             case Nl: break;
         
             // If not an ID, read and increment the location counter
+            // Branches and jumps to a label are recorded for relaxation.
             default: {
+                bool site = sites && ((token.type >= Beq && token.type <= Bgeu) || token.type == Jal);
+                SiteKind kind = token.type == Jal ? SiteJal : SiteBranch;
                 while (token.type != Eof && token.type != Nl) {
+                    if (site && token.type == Id) {
+                        sites->push_back({ lc, token.sym, kind, 4, lc });
+                        site = false;
+                    }
                     token = lex->getNext();
                 }
                 lc += 4;
@@ -47,6 +55,6 @@ std::map<std::string, int> Pass1::run() {
         token = lex->getNext();
     }
     
-    return labels;
+    return lc;
 }
 
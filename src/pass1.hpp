@@ -1,15 +1,24 @@
 #pragma once
 
 #include <string>
-#include <map>
+#include <iostream>
+#include <vector>
 
 #include "lex.hpp"
+#include "symtab.hpp"
+#include "relax.hpp"
 
 class Pass1 {
 public:
-    explicit Pass1(std::string input);
-    std::map<std::string, int> run();
+    explicit Pass1(Lex *lex, SymbolTable *symbols);
+    int run(int lc = 0);
+    
+    void setErrors(std::ostream *errors) { this->errors = errors; }
+    void setSites(std::vector<Site> *sites) { this->sites = sites; }
 private:
     Lex *lex;
+    SymbolTable *symbols;
+    std::ostream *errors = &std::cerr;
+    std::vector<Site> *sites = nullptr;     // Branches and jumps to relax, if wanted
 };
 
@@ -1,22 +1,48 @@
 #include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <algorithm>
 
 #include "pass2.hpp"
 #include "lex.hpp"
+#include "isa.hpp"
 
-Pass2::Pass2(std::string input, std::string output) {
-    lex = new Lex(input);
-    file = fopen(output.c_str(), "wb");
-}
+// Entries parsed before they are encoded; small enough to stay in cache
+constexpr size_t IR_BLOCK = 4096;
 
-void Pass2::setMap(std::map<std::string, int> labels) {
-    this->labels = labels;
+Pass2::Pass2(Lex *lex, SymbolTable *symbols) {
+    this->lex = lex;
+    this->symbols = symbols;
+    program.reserve(IR_BLOCK);
 }
 
+//
+// Parses and encodes the source a block at a time
+//
 void Pass2::run() {
-    Token token = lex->getNext();
-    while (token.type != Eof) {
+    bool more = true;
+    while (more) {
+        more = parse(IR_BLOCK);
+        encode();
+        program.clear();
+    }
+    
+    // Patch forward references
+    if (singlePass) {
+        applyFixups();
+    }
+}
+
+//
+// Parses statements into the program until it holds limit entries
+// Returns false once the end of the source is reached.
+//
+bool Pass2::parse(size_t limit) {
+    while (program.size() < limit) {
+        Token token = next();
         switch (token.type) {
+            case Eof: return false;
+            
             // R-Type
             case Add:
             case Sub:
@@ -27,7 +53,7 @@ void Pass2::run() {
             case Srl:
             case Sra:
             case Or:
-            case And: build_r(token.type); break;
+            case And: parse_r(token.type); break;
             
             case Jalr:
             case Ecall:
@@ -39,702 +65,507 @@ void Pass2::run() {
             case Srai:
             case Xori:
             case Ori:
-            case Andi: build_i(token.type); break;
+            case Andi: parse_i(token.type); break;
             
             case Lb:
             case Lh:
             case Lw:
             case Lbu:
-            case Lhu: build_load(token.type); break;
+            case Lhu: parse_load(token.type); break;
             
             case Sb:
             case Sh:
-            case Sw: build_store(token.type); break;
+            case Sw: parse_store(token.type); break;
             
             case Beq:
             case Bne:
             case Blt:
             case Bge:
             case Bltu:
-            case Bgeu: build_br(token.type); break;
+            case Bgeu: parse_br(token.type); break;
             
             case Lui:
             case Auipc:
-            case Jal: build_uj(token.type); break;
+            case Jal: parse_uj(token.type); break;
             
-            case Flw: build_fload(token.type); break;
-            case Fsw: build_fstore(token.type); break;
+            case Flw: parse_fload(token.type); break;
+            case Fsw: parse_fstore(token.type); break;
             case Fadds:
-            case Fsubs: build_falu(token.type); break;
+            case Fsubs: parse_falu(token.type); break;
             
             // TODO: Change to addi
-            case Nop: {
-                uint32_t instr = 0;
-                if (format == "default") {
-                    fwrite(&instr, sizeof(uint32_t), 1, file);
-                } else if (format == "string") {
-                    std::string output = convertToBinary(instr);
-                    fputs(output.c_str(), file);
-                    fputc('\n', file);
-                }
-                lc += 4;
-            } break;
-            
-            case Hlt: {
-                uint32_t instr = 0xFFFFFFFF;
-                if (format == "default") {
-                    fwrite(&instr, sizeof(uint32_t), 1, file);
-                } else if (format == "string") {
-                    std::string output = convertToBinary(instr);
-                    fputs(output.c_str(), file);
-                    fputc('\n', file);
-                }
-                lc += 4;
-            } break;
+            case Nop:
+            case Hlt: program.add(token.type, 0, 0, 0, 0, false, line); break;
             
             case Id: {
+                int at = line;
+                if (singlePass) symbols->define(token.sym, lc + program.bytes);
+                
                 // Next token is always a colon
-                token = lex->getNext();
-                token = lex->getNext();
-                if (token.type == String) {
-                    for (char c : token.id) {
-                        fputc(c, file);
-                    }
-                    lc += token.id.length();
-                }
+                token = next();
+                token = next();
+                if (token.type == String) program.addData(token.id, at);
             } break;
             
             default: {}
         }
-        
-        token = lex->getNext();
     }
     
-    
-    // Close everything
-    delete lex;
-    fclose(file);
+    return true;
 }
 
 //
-// Builds R-Type instructions
+// Reads the next token, keeping track of the line number
 //
-void Pass2::build_r(TokenType opcode) {
-    // Get each token
-    int rd, rs1, rs2;
+Token Pass2::next() {
     Token token = lex->getNext();
-    rd = getRegister(token.type);
-    if (rd == -1) {
-        std::cerr << "Invalid token: Expected register." << std::endl;
-        return;
+    tokens += token.type != Eof;
+    if (token.type == Nl) {
+        ++line;
+    } else if (token.type == String) {
+        line += std::count(token.id.begin(), token.id.end(), '\n');
     }
-    
-    checkComma();
-    
-    token = lex->getNext();
-    rs1 = getRegister(token.type);
-    if (rs1 == -1) {
-        std::cerr << "Invalid token: Expected register source 1." << std::endl;
-        return;
+    return token;
+}
+
+//
+// Encodes every entry of the program and appends it to the image
+//
+void Pass2::encode() {
+    size_t offset = image.bytes.size();
+    image.bytes.resize(offset + program.bytes);
+    uint8_t *out = image.bytes.data() + offset;
+    
+    for (size_t i = 0; i<program.size(); i++) {
+        TokenType op = program.op[i];
+        if (op == String) {
+            DataRef data = program.data[program.imm[i]];
+            image.data.push_back({ (size_t)(out - image.bytes.data()), data.length });
+            memcpy(out, program.text.data() + data.offset, data.length);
+            out += data.length;
+            lc += data.length;
+            continue;
+        }
+        
+        // Every instruction is a table lookup and a shift/OR by format
+        const InstrInfo &info = instrTable[op];
+        int imm = program.imm[i];
+        if (program.label[i]) {
+            FixupType type = FixImm;
+            if (program.label[i] == LabelPcHi) type = FixPcHi;
+            else if (program.label[i] == LabelPcLo) type = FixPcLo;
+            else if (info.format == BType) type = FixBranch;
+            else if (info.format == JType) type = FixJal;
+            else if (info.format == UType) type = FixHi;
+            imm = resolve(i, type);
+        }
+        
+        uint32_t instr = ::encode(info, program.rd[i], program.rs1[i], program.rs2[i], imm);
+        memcpy(out, &instr, sizeof(uint32_t));
+        out += sizeof(uint32_t);
+        lc += 4;
     }
+}
+
+//
+// Looks up the label operand of an entry
+// Branches and jumps get the offset from the current instruction, lui the
+// upper bits of the address (rounded, so an addi of the lower bits adds
+// up to it), other instructions the address itself. The auipc and jalr of
+// a relaxed jump split the offset the same way. If the label is not
+// defined yet, single-pass mode records a fixup and the field is patched
+// later.
+//
+int Pass2::resolve(size_t i, FixupType type) {
+    int sym = program.imm[i];
     
-    checkComma();
-    
-    token = lex->getNext();
-    rs2 = getRegister(token.type);
-    if (rs2 == -1) {
-        std::cerr << "Invalid token: Expected register source 2." << std::endl;
-        return;
+    // The final address is not known until link time
+    if (relocatable && (type == FixImm || type == FixHi)) {
+        addReloc(lc, sym, type);
+        return 0;
     }
     
-    checkNL();
-    
-    // Get the ALU operand
-    int func3 = getALU(opcode);
+    if (symbols->isDefined(sym)) {
+        int address = symbols->getAddress(sym);
+        if (type == FixImm) return address;
+        if (type == FixHi) return ((uint32_t)address + 0x800) >> 12;
+        if (type == FixPcHi) return ((uint32_t)(address - lc) + 0x800) >> 12;
+        if (type == FixPcLo) return address - (lc - 4);
+        
+        int offset = address - lc;
+        if (type == FixBranch ? !fitsBranch(offset) : !fitsJal(offset)) {
+            *errors << "Error: Label \'" << symbols->getName(sym) << "\' is out of range on line " << program.line[i] << "." << std::endl;
+        }
+        return offset;
+    }
     
-    uint32_t func7 = 0;
-    if (opcode == Sub || opcode == Sra) {
-        func7 = 32;
+    if (singlePass) {
+        fixups.push_back({ type, lc, sym, (int)program.line[i] });
+    } else if (relocatable) {
+        addReloc(lc, sym, type);
+    } else {
+        *errors << "Error: Undefined label \'" << symbols->getName(sym) << "\' on line " << program.line[i] << "." << std::endl;
+    }
+    return 0;
+}
+
+//
+// The size relaxation gave the branch or jump being parsed
+// Without sites, every branch and jump keeps its 4 bytes.
+//
+int Pass2::siteSize() {
+    int here = lc + (int)program.bytes;
+    while (site != lastSite && site->at < here) ++site;
+    if (site != lastSite && site->at == here) return site->size;
+    return 4;
+}
+
+//
+// Records a relocation for the instruction at lc
+//
+void Pass2::addReloc(int lc, int sym, FixupType type) {
+    RelocType reloc = RelocLo12;
+    switch (type) {
+        case FixBranch: reloc = RelocBranch; break;
+        case FixJal: reloc = RelocJal; break;
+        case FixImm: reloc = RelocLo12; break;
+        case FixHi: reloc = RelocHi20; break;
+        default: {}
     }
+    image.relocs.push_back({ (size_t)(lc - start), sym, reloc });
+}
 
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    instr |= (uint32_t)(0b0110011);     // I-Type opcode
-    instr |= (uint32_t)(rd << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    instr |= (uint32_t)(rs2 << 20);
-    instr |= (uint32_t)(func7 << 25);
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
-    }
-    lc += 4;
+//
+// Patches every recorded forward reference into the image
+//
+void Pass2::applyFixups() {
+    for (Fixup &fixup : fixups) {
+        if (!symbols->isDefined(fixup.sym)) {
+            if (relocatable) {
+                addReloc(fixup.lc, fixup.sym, fixup.type);
+                continue;
+            }
+            
+            *errors << "Error: Undefined label \'" << symbols->getName(fixup.sym) << "\' on line " << fixup.line << "." << std::endl;
+            continue;
+        }
+        
+        int address = symbols->getAddress(fixup.sym);
+        int offset = address - fixup.lc;
+        bool inRange = fixup.type == FixBranch ? fitsBranch(offset) : fixup.type != FixJal || fitsJal(offset);
+        if (!inRange) {
+            *errors << "Error: Label \'" << symbols->getName(fixup.sym) << "\' is out of range on line " << fixup.line << "." << std::endl;
+            continue;
+        }
+        
+        uint32_t instr;
+        memcpy(&instr, &image.bytes[fixup.lc - start], sizeof(uint32_t));
+        
+        switch (fixup.type) {
+            case FixBranch: instr |= encodeBranch(offset); break;
+            case FixJal: instr |= encodeJal(offset); break;
+            case FixImm: instr |= (uint32_t)(address << 20); break;
+            case FixHi: instr |= (((uint32_t)address + 0x800) >> 12) << 12; break;
+            default: {}
+        }
+        
+        memcpy(&image.bytes[fixup.lc - start], &instr, sizeof(uint32_t));
+    }
 }
 
 //
-// Builds I-Type instructions
+// Parses R-Type instructions
 //
-void Pass2::build_i(TokenType opcode) {
+void Pass2::parse_r(TokenType opcode) {
+    int at = line;
+    
     // Get each token
-    int rd, rs1, imm;
-    Token token = lex->getNext();
+    int rd, rs1, rs2;
+    Token token = next();
     rd = getRegister(token.type);
     if (rd == -1) {
-        std::cerr << "Invalid token: Expected register." << std::endl;
+        *errors << "Invalid token: Expected register." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
+    token = next();
     rs1 = getRegister(token.type);
     if (rs1 == -1) {
-        std::cerr << "Invalid token: Expected register source 1." << std::endl;
+        *errors << "Invalid token: Expected register source 1." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
-    imm = token.imm;
-    if (token.type == Id) {
-        imm = labels[token.id];
-    } else if (token.type != Imm) {
-        std::cerr << "Invalid token: Expected immediate for source 2." << std::endl;
+    token = next();
+    rs2 = getRegister(token.type);
+    if (rs2 == -1) {
+        *errors << "Invalid token: Expected register source 2." << std::endl;
         return;
     }
     
     checkNL();
     
-    // Get the ALU operand
-    int func3 = getALU(opcode);
-
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    if (opcode == Jalr) {
-        instr |= (uint32_t)(0b1100111);     // (JALR) I-Type opcode
-    } else if (opcode == Ecall) {
-        instr |= (uint32_t)(0b1100111);     // (ECALL) I-Type opcode
-        func3 = 0b111;
-    } else {
-        instr |= (uint32_t)(0b0010011);     // I-Type opcode
-    }
-    
-    instr |= (uint32_t)(rd << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    
-    // Encode the operand
-    // This differs slightly with the shift instructions
-    if (opcode == Slli || opcode == Srli || opcode == Srai) {
-        uint8_t func7 = 0;
-        if (opcode == Srai) func7 = 32;
-        
-        instr |= (uint32_t)(((uint8_t)imm) << 20);
-        instr |= (uint32_t)(func7 << 25);
-    } else {
-        instr |= (uint32_t)(imm << 20);
-    }
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
-    }
-    lc += 4;
+    program.add(opcode, rd, rs1, rs2, 0, false, at);
 }
 
 //
-// Builds the load instructions
+// Parses I-Type instructions
+// The immediate can also be a label, which stands for its address.
 //
-void Pass2::build_load(TokenType opcode) {
+void Pass2::parse_i(TokenType opcode) {
+    int at = line;
+    
     // Get each token
     int rd, rs1, imm;
-    Token token = lex->getNext();
+    Token token = next();
     rd = getRegister(token.type);
     if (rd == -1) {
-        std::cerr << "Invalid token: Expected register." << std::endl;
+        *errors << "Invalid token: Expected register." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
-    imm = token.imm;
-    if (token.type != Imm) {
-        std::cerr << "Invalid token: Expected offset." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
-    if (token.type != LParen) {
-        std::cerr << "Invalid token: Expected \'(\'." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
+    token = next();
     rs1 = getRegister(token.type);
     if (rs1 == -1) {
-        std::cerr << "Invalid token: expected offset register." << std::endl;
+        *errors << "Invalid token: Expected register source 1." << std::endl;
         return;
     }
     
-    token = lex->getNext();
-    if (token.type != RParen) {
-        std::cerr << "Invalid token: Expected \')\'." << std::endl;
+    checkComma();
+    
+    token = next();
+    bool label = token.type == Id;
+    imm = label ? token.sym : token.imm;
+    if (!label && token.type != Imm) {
+        *errors << "Invalid token: Expected immediate for source 2." << std::endl;
         return;
     }
     
     checkNL();
     
-    // Encode func3
-    int func3 = 0b010;
-    switch (opcode) {
-        case Lb: func3 = 0b000; break;
-        case Lh: func3 = 0b001; break;
-        case Lw: func3 = 0b010; break;
-        case Lbu: func3 = 0b100; break;
-        case Lhu: func3 = 0b101; break;
-        
-        default: {}
-    }
-    
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    instr |= (uint32_t)(0b0000011);     // Load-Type opcode
-    instr |= (uint32_t)(rd << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    instr |= (uint32_t)(imm << 20);
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
-    }
-    lc += 4;
+    program.add(opcode, rd, rs1, 0, imm, label, at);
 }
 
 //
-// Builds store instructions
+// Parses the "reg, offset(reg)" operands of loads and stores
+// reg is an integer register, or a float register if isFloat is set.
 //
-void Pass2::build_store(TokenType opcode) {
-    // Get each token
-    int rd, rs1, imm;
-    Token token = lex->getNext();
-    rd = getRegister(token.type);
-    if (rd == -1) {
-        std::cerr << "Invalid token: Expected register." << std::endl;
-        return;
+bool Pass2::parseMemory(bool isFloat, int &reg, int &rs1, int &imm) {
+    Token token = next();
+    reg = isFloat ? getFloatRegister(token.type) : getRegister(token.type);
+    if (reg == -1) {
+        *errors << "Invalid token: Expected register." << std::endl;
+        return false;
     }
     
     checkComma();
     
-    token = lex->getNext();
+    token = next();
     imm = token.imm;
     if (token.type != Imm) {
-        std::cerr << "Invalid token: Expected offset." << std::endl;
-        return;
+        *errors << "Invalid token: Expected offset." << std::endl;
+        return false;
     }
     
-    token = lex->getNext();
+    token = next();
     if (token.type != LParen) {
-        std::cerr << "Invalid token: Expected \'(\'." << std::endl;
-        return;
+        *errors << "Invalid token: Expected \'(\'." << std::endl;
+        return false;
     }
     
-    token = lex->getNext();
+    token = next();
     rs1 = getRegister(token.type);
     if (rs1 == -1) {
-        std::cerr << "Invalid token: expected offset register." << std::endl;
-        return;
+        *errors << "Invalid token: expected offset register." << std::endl;
+        return false;
     }
     
-    token = lex->getNext();
+    token = next();
     if (token.type != RParen) {
-        std::cerr << "Invalid token: Expected \')\'." << std::endl;
-        return;
+        *errors << "Invalid token: Expected \')\'." << std::endl;
+        return false;
     }
     
     checkNL();
-    
-    // Encode func3
-    uint8_t func3 = 0b010;
-    switch (opcode) {
-        case Sb: func3 = 0b000; break;
-        case Sh: func3 = 0b001; break;
-        case Sw: func3 = 0b010; break;
-        
-        default: {}
+    return true;
+}
+
+//
+// Parses the load instructions
+//
+void Pass2::parse_load(TokenType opcode) {
+    int at = line;
+    int rd, rs1, imm;
+    if (parseMemory(false, rd, rs1, imm)) {
+        program.add(opcode, rd, rs1, 0, imm, false, at);
     }
-    
-    // Encode the immediate
-    uint8_t imm1 = (uint8_t)(imm & 0x1F);
-    uint8_t imm2 = (uint8_t)(imm >> 5);
-    
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    instr |= (uint32_t)(0b0100011);     // Store-Type opcode
-    instr |= (uint32_t)(imm1 << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    instr |= (uint32_t)(rd << 20);
-    instr |= (uint32_t)(imm2 << 25);
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
+}
+
+//
+// Parses store instructions
+//
+void Pass2::parse_store(TokenType opcode) {
+    int at = line;
+    int rs2, rs1, imm;
+    if (parseMemory(false, rs2, rs1, imm)) {
+        program.add(opcode, 0, rs1, rs2, imm, false, at);
     }
-    lc += 4;
 }
 
 //
-// Builds the branch instructions
+// Parses the branch instructions
 //
-void Pass2::build_br(TokenType opcode) {
+void Pass2::parse_br(TokenType opcode) {
+    int at = line;
+    
     // Get each token
-    int rs1, rs2, imm;
-    Token token = lex->getNext();
+    int rs1, rs2;
+    Token token = next();
     rs1 = getRegister(token.type);
     if (rs1 == -1) {
-        std::cerr << "Invalid token: Expected register source 1." << std::endl;
+        *errors << "Invalid token: Expected register source 1." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
+    token = next();
     rs2 = getRegister(token.type);
     if (rs2 == -1) {
-        std::cerr << "Invalid token: Expected register source 2." << std::endl;
+        *errors << "Invalid token: Expected register source 2." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
-    imm = labels[token.id];
+    token = next();
     if (token.type != Id) {
-        std::cerr << "Invalid token: Expected label." << std::endl;
+        *errors << "Invalid token: Expected label." << std::endl;
         return;
     }
+    int sym = token.sym;
     
     checkNL();
     
-    // Get the branch operand
-    int func3 = 0;
-    switch (opcode) {
-        case Beq: func3 = 0; break;
-        case Bne: func3 = 0b001; break;
-        case Blt: func3 = 0b100; break;
-        case Bge: func3 = 0b101; break;
-        case Bltu: func3 = 0b110; break;
-        case Bgeu: func3 = 0b111; break;
-        
-        default: {}
+    int size = siteSize();
+    if (size == 4) {
+        program.add(opcode, 0, rs1, rs2, sym, LabelRef, at);
+        return;
     }
     
-    // Encode the immediate
-    imm -= lc;
-    
-    uint8_t imm1 = (uint8_t)((imm & 0x00800) >> 11);    // Bit 11
-           imm1 |= (uint8_t)(imm & 0b00011110);         // Bit [4:1]
-    uint8_t imm2 = (uint8_t)((imm & 0x007E0) >> 5);     // Bit [10:5]
-           imm2 |= (uint8_t)((imm & 0x01000) >> 6);     // Bit 12
-
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    instr |= (uint32_t)(0b1100011);     // B-Type opcode
-    instr |= (uint32_t)(imm1 << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    instr |= (uint32_t)(rs2 << 20);
-    instr |= (uint32_t)(imm2 << 25);
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
-    }
-    lc += 4;
+    // Out of reach: skip over a jump on the opposite condition
+    // (TokenType lists the branches in opposite pairs)
+    TokenType inverse = (TokenType)(Beq + ((opcode - Beq) ^ 1));
+    program.add(inverse, 0, rs1, rs2, size, LabelNone, at);
+    if (size == 8) {
+        program.add(Jal, 0, 0, 0, sym, LabelRef, at);
+    } else {
+        program.add(Auipc, RELAX_SCRATCH, 0, 0, sym, LabelPcHi, at);
+        program.add(Jalr, 0, RELAX_SCRATCH, 0, sym, LabelPcLo, at);
+    }
 }
 
 //
-// Builds U/J-Type instructions
+// Parses U/J-Type instructions
 //
-void Pass2::build_uj(TokenType opcode) {
+void Pass2::parse_uj(TokenType opcode) {
+    int at = line;
+    
     // Get each token
-    int rd;
-    uint32_t imm = 0;
-    Token token = lex->getNext();
+    int rd, imm;
+    Token token = next();
     rd = getRegister(token.type);
     if (rd == -1) {
-        std::cerr << "Invalid token: Expected register." << std::endl;
+        *errors << "Invalid token: Expected register." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
-    if (opcode == Jal && token.type == Id) {
-        imm = labels[token.id] - lc;
-    } else {
-        imm = token.imm;
-        if (token.type != Imm) {
-            std::cerr << "Invalid token: Expected label or immediate." << std::endl;
-            return;
-        }
+    token = next();
+    bool label = (opcode == Jal || opcode == Lui) && token.type == Id;
+    imm = label ? token.sym : token.imm;
+    if (!label && token.type != Imm) {
+        *errors << "Invalid token: Expected label or immediate." << std::endl;
+        return;
     }
     
     checkNL();
     
-    // If we have the JAL instruction, we need to do the fancy encoding
-    if (opcode == Jal) {
-        uint32_t imm1 = (uint32_t)((imm & 0x0FF000) >> 12);     // imm[19:12]    -> 0:8
-                imm1 |= (uint32_t)((imm & 0x0800) >> 2);        // imm[11]       -> 9
-                imm1 |= (uint32_t)((imm & 0x07FE) << 8);        // imm[10:1]     -> 10
-                imm1 |= (uint32_t)((imm & 100000) >> 9);        // imm[20]       -> 11
-        
-        imm = imm1;
-    }
-    
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    if (opcode == Lui) {
-        instr |= (uint32_t)(0b0110111);     // Lui U-Type opcode
-    } else if (opcode == Auipc) {
-        instr |= (uint32_t)(0b0010111);     // Auipc U-Type opcode
-    } else if (opcode == Jal) {
-        instr |= (uint32_t)(0b1101111);     // J-Type opcode
+    // A jal out of reach jumps through auipc instead
+    if (label && opcode == Jal && siteSize() == 8) {
+        int scratch = rd == 0 ? RELAX_SCRATCH : rd;
+        program.add(Auipc, scratch, 0, 0, imm, LabelPcHi, at);
+        program.add(Jalr, rd, scratch, 0, imm, LabelPcLo, at);
+        return;
     }
-    instr |= (uint32_t)(rd << 7);
-    instr |= (uint32_t)(imm << 12);
     
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
-    }
-    lc += 4;
+    program.add(opcode, rd, 0, 0, imm, label, at);
 }
 
 //
-// Builds an flw instruction (float-load)
+// Parses an flw instruction (float-load)
 //
-void Pass2::build_fload(TokenType opcode) {
-        // Get each token
+void Pass2::parse_fload(TokenType opcode) {
+    int at = line;
     int rd, rs1, imm;
-    Token token = lex->getNext();
-    rd = getFloatRegister(token.type);
-    if (rd == -1) {
-        std::cerr << "Invalid token: Expected register." << std::endl;
-        return;
-    }
-    
-    checkComma();
-    
-    token = lex->getNext();
-    imm = token.imm;
-    if (token.type != Imm) {
-        std::cerr << "Invalid token: Expected offset." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
-    if (token.type != LParen) {
-        std::cerr << "Invalid token: Expected \'(\'." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
-    rs1 = getRegister(token.type);
-    if (rs1 == -1) {
-        std::cerr << "Invalid token: expected offset register." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
-    if (token.type != RParen) {
-        std::cerr << "Invalid token: Expected \')\'." << std::endl;
-        return;
-    }
-    
-    checkNL();
-    
-    // Encode func3
-    int func3 = 0b010;
-    
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    instr |= (uint32_t)(0b0000111);     // Float Load-Type opcode
-    instr |= (uint32_t)(rd << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    instr |= (uint32_t)(imm << 20);
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
+    if (parseMemory(true, rd, rs1, imm)) {
+        program.add(opcode, rd, rs1, 0, imm, false, at);
     }
-    lc += 4;
 }
 
 //
-// Builds an fsw instruction (float-store)
+// Parses an fsw instruction (float-store)
 //
-void Pass2::build_fstore(TokenType opcode) {
-    // Get each token
-    int rd, rs1, imm;
-    Token token = lex->getNext();
-    rd = getFloatRegister(token.type);
-    if (rd == -1) {
-        std::cerr << "Invalid token: Expected register." << std::endl;
-        return;
-    }
-    
-    checkComma();
-    
-    token = lex->getNext();
-    imm = token.imm;
-    if (token.type != Imm) {
-        std::cerr << "Invalid token: Expected offset." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
-    if (token.type != LParen) {
-        std::cerr << "Invalid token: Expected \'(\'." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
-    rs1 = getRegister(token.type);
-    if (rs1 == -1) {
-        std::cerr << "Invalid token: expected offset register." << std::endl;
-        return;
-    }
-    
-    token = lex->getNext();
-    if (token.type != RParen) {
-        std::cerr << "Invalid token: Expected \')\'." << std::endl;
-        return;
-    }
-    
-    checkNL();
-    
-    // Encode func3
-    int func3 = 0b010;
-    
-    // Encode the immediate
-    uint8_t imm1 = (uint8_t)imm;
-    uint8_t imm2 = (uint8_t)(imm >> 5);
-    
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    instr |= (uint32_t)(0b0100111);     // Store-Type opcode
-    instr |= (uint32_t)(imm1 << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    instr |= (uint32_t)(rd << 20);
-    instr |= (uint32_t)(imm2 << 25);
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
+void Pass2::parse_fstore(TokenType opcode) {
+    int at = line;
+    int rs2, rs1, imm;
+    if (parseMemory(true, rs2, rs1, imm)) {
+        program.add(opcode, 0, rs1, rs2, imm, false, at);
     }
-    lc += 4;
 }
 
 //
-// Builds a floating-point math instruction
-// Note: Only fadd.s supported at the moment
+// Parses a floating-point math instruction
 //
-void Pass2::build_falu(TokenType opcode) {
+void Pass2::parse_falu(TokenType opcode) {
+    int at = line;
+    
     // Get each token
     int rd, rs1, rs2;
-    Token token = lex->getNext();
+    Token token = next();
     rd = getFloatRegister(token.type);
     if (rd == -1) {
-        std::cerr << "Invalid token: Expected float register." << std::endl;
+        *errors << "Invalid token: Expected float register." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
+    token = next();
     rs1 = getFloatRegister(token.type);
     if (rs1 == -1) {
-        std::cerr << "Invalid token: Expected float register source 1." << std::endl;
+        *errors << "Invalid token: Expected float register source 1." << std::endl;
         return;
     }
     
     checkComma();
     
-    token = lex->getNext();
+    token = next();
     rs2 = getFloatRegister(token.type);
     if (rs2 == -1) {
-        std::cerr << "Invalid token: Expected float register source 2." << std::endl;
+        *errors << "Invalid token: Expected float register source 2." << std::endl;
         return;
     }
     
     checkNL();
     
-    // Set rm
-    int func3 = 0b111;
-    
-    uint32_t func7 = 0;
-    if (opcode == Fsubs) {
-        func7 = 4;
-    }
-
-    // Encode the instruction
-    uint32_t instr = 0;
-    
-    instr |= (uint32_t)(0b1010011);     // F-Type alu opcode
-    instr |= (uint32_t)(rd << 7);
-    instr |= (uint32_t)(func3 << 12);
-    instr |= (uint32_t)(rs1 << 15);
-    instr |= (uint32_t)(rs2 << 20);
-    instr |= (uint32_t)(func7 << 25);
-    
-    if (format == "default") {
-        fwrite(&instr, sizeof(uint32_t), 1, file);
-    } else if (format == "string") {
-        std::string output = convertToBinary(instr);
-        fputs(output.c_str(), file);
-        fputc('\n', file);
-    }
-    lc += 4;
+    program.add(opcode, rd, rs1, rs2, 0, false, at);
 }
 
 //
@@ -830,75 +661,21 @@ int Pass2::getFloatRegister(TokenType token) {
     return -1;
 }
 
-//
-// Translates an ALU operand
-//
-int Pass2::getALU(TokenType token) {
-    switch (token) {
-        case Jalr:
-        case Addi:
-        case Add:
-        case Sub: return 0b000;
-        
-        case Slli:
-        case Sll: return 0b001;
-        
-        case Slti:
-        case Slt: return 0b010;
-        
-        case Sltiu:
-        case Sltu: return 0b011;
-        
-        case Xori:
-        case Xor: return 0b100;
-        
-        case Srli: case Srai:
-        case Srl:
-        case Sra: return 0b101;
-        
-        case Ori:
-        case Or: return 0b110;
-        
-        case Andi:
-        case And: return 0b111;
-        
-        default: {}
-    }
-    
-    return 0;
-}
-
-//
-// Converts a binary instruction to a base-2 string
-// This utility is for VHDL testing
-//
-std::string Pass2::convertToBinary(uint32_t instr) {
-    std::string output = "";
-    
-    for (int i = 0; i<32; i++) {
-        uint8_t data = 0;
-        data = (instr >> i) & 0x01;
-        output = char(data + '0') + output;
-    }
-    
-    return output;
-}
-
 //
 // A helpful syntax utility function
 //
 void Pass2::checkComma() {
-    Token token = lex->getNext();
+    Token token = next();
     if (token.type != Comma) {
-        std::cerr << "Error: Expected \',\'." << std::endl;
+        *errors << "Error: Expected \',\'." << std::endl;
         return;
     }
 }
 
 void Pass2::checkNL() {
-    Token token = lex->getNext();
-    if (token.type != Nl) {
-        std::cerr << "Error: Expected newline." << std::endl;
+    Token token = next();
+    if (token.type != Nl && token.type != Eof) {
+        *errors << "Error: Expected newline." << std::endl;
         return;
     }
 }
@@ -1,41 +1,101 @@
 #pragma once
 
 #include <string>
-#include <cstdio>
-#include <map>
+#include <iostream>
+#include <vector>
+#include <string_view>
 
 #include "lex.hpp"
+#include "symtab.hpp"
+#include "output.hpp"
+#include "ir.hpp"
+#include "relax.hpp"
 
+//
+// The kinds of label references that can be patched later
+//
+enum FixupType {
+    FixBranch,      // B-Type offset
+    FixJal,         // J-Type offset
+    FixImm,         // I-Type absolute address
+    FixHi,          // U-Type upper bits of the absolute address
+    FixPcHi,        // U-Type upper bits of the offset
+    FixPcLo         // I-Type lower bits of the offset from the instruction before
+};
+
+struct Fixup {
+    FixupType type;
+    int lc;
+    int sym;
+    int line;
+};
+
+//
+// Pass 2 parses the source into a Program and encodes it into an Image
+// The two steps run a block of entries at a time, so the block stays in
+// cache and a streamed source is never held in memory as a whole.
+//
 class Pass2 {
 public:
-    explicit Pass2(std::string input, std::string output);
-    void setMap(std::map<std::string, int> labels);
+    explicit Pass2(Lex *lex, SymbolTable *symbols);
     void run();
+    bool parse(size_t limit);
+    void encode();
     
-    void setFormat(std::string format) { this->format = format; }
+    void setSinglePass(bool singlePass) { this->singlePass = singlePass; }
+    void setRelocatable(bool relocatable) { this->relocatable = relocatable; }
+    void setStart(int lc) { this->lc = lc; start = lc; }
+    void setStartLine(int line) { this->line = line; }
+    void setErrors(std::ostream *errors) { this->errors = errors; }
+    void setSites(const Site *first, const Site *last) { site = first; lastSite = last; }
+    void reserve(size_t size) { image.bytes.reserve(size); }
+    Program &getProgram() { return program; }
+    Image &getImage() { return image; }
+    size_t getTokens() const { return tokens; }
 protected:
-    void build_r(TokenType opcode);
-    void build_i(TokenType opcode);
-    void build_load(TokenType opcode);
-    void build_store(TokenType opcode);
-    void build_br(TokenType opcode);
-    void build_uj(TokenType opcode);
-    void build_fload(TokenType opcode);
-    void build_fstore(TokenType opcode);
-    void build_falu(TokenType opcode);
+    void parse_r(TokenType opcode);
+    void parse_i(TokenType opcode);
+    void parse_load(TokenType opcode);
+    void parse_store(TokenType opcode);
+    void parse_br(TokenType opcode);
+    void parse_uj(TokenType opcode);
+    void parse_fload(TokenType opcode);
+    void parse_fstore(TokenType opcode);
+    void parse_falu(TokenType opcode);
+    bool parseMemory(bool isFloat, int &reg, int &rs1, int &imm);
     int getRegister(TokenType token);
     int getFloatRegister(TokenType token);
-    int getALU(TokenType token);
-    std::string convertToBinary(uint32_t instr);
+    int siteSize();
+    int resolve(size_t i, FixupType type);
+    void addReloc(int lc, int sym, FixupType type);
+    void applyFixups();
+    Token next();
     void checkComma();
     void checkNL();
 private:
     Lex *lex;
-    FILE *file;
-    std::map<std::string, int> labels;
+    SymbolTable *symbols;
+    std::ostream *errors = &std::cerr;
     int lc = 0;
+    int start = 0;      // Location counter at the start of the image
+    int line = 1;
+    size_t tokens = 0;  // Tokens read, for the stats
     
-    // Formats: default, string
-    std::string format = "default";
+    // The block being parsed, and the encoded program
+    Program program;
+    Image image;
+    
+    // Single-pass mode: labels are defined as they are seen, forward
+    // references are patched into the image at the end
+    bool singlePass = false;
+    std::vector<Fixup> fixups;
+    
+    // Relocatable mode: absolute addresses and undefined labels are left
+    // to the linker as relocations
+    bool relocatable = false;
+    
+    // Relaxed branches and jumps, in address order; the ones not yet
+    // reached start at site
+    const Site *site = nullptr;
+    const Site *lastSite = nullptr;
 };
-
@@ -0,0 +1,79 @@
+#include <thread>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+#include "pool.hpp"
+
+WorkPool::WorkPool(unsigned threads) : queues(threads == 0 ? 1 : threads) {
+    this->threads = threads == 0 ? 1 : threads;
+}
+
+//
+// Runs job(i) for every i < count and waits for all of them
+//
+void WorkPool::run(size_t count, const std::function<void(size_t)> &job) {
+    for (size_t i = 0; i<count; i++) {
+        queues[i % threads].jobs.push_back(i);
+    }
+    
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i<threads && i<count; i++) {
+        workers.emplace_back(&WorkPool::work, this, i, std::cref(job));
+    }
+    work(0, job);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+void WorkPool::work(unsigned worker, const std::function<void(size_t)> &job) {
+    size_t index;
+    while (take(worker, index) || steal(worker, index)) {
+        job(index);
+    }
+}
+
+//
+// Pops the next job off the front of the worker's own queue
+//
+bool WorkPool::take(unsigned worker, size_t &index) {
+    Queue &queue = queues[worker];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.jobs.empty()) return false;
+    
+    index = queue.jobs.front();
+    queue.jobs.pop_front();
+    return true;
+}
+
+//
+// Pops a job off the back of another worker's queue
+// No jobs are added during a run, so once every queue is empty the
+// worker is done.
+//
+bool WorkPool::steal(unsigned worker, size_t &index) {
+    for (unsigned i = 1; i<threads; i++) {
+        Queue &queue = queues[(worker + i) % threads];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.jobs.empty()) continue;
+        
+        index = queue.jobs.back();
+        queue.jobs.pop_back();
+        return true;
+    }
+    return false;
+}
+
+//
+// Parses a thread count given on the command line
+// It must be a whole, positive number.
+//
+bool parseJobs(const char *text, unsigned &jobs) {
+    char *end = nullptr;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || value < 1 || value > INT_MAX) return false;
+    jobs = (unsigned)value;
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+//
+// A fixed set of worker threads for a list of independent jobs
+// Jobs are dealt out to per-thread queues up front. Each thread works
+// through its own queue from the front and, once it runs dry, steals from
+// the back of the other queues, so a few slow jobs do not hold up the rest.
+//
+class WorkPool {
+public:
+    explicit WorkPool(unsigned threads);
+    void run(size_t count, const std::function<void(size_t)> &job);
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+    
+    void work(unsigned worker, const std::function<void(size_t)> &job);
+    bool take(unsigned worker, size_t &index);
+    bool steal(unsigned worker, size_t &index);
+    
+    unsigned threads;
+    std::vector<Queue> queues;
+};
+
+bool parseJobs(const char *text, unsigned &jobs);
@@ -0,0 +1,176 @@
+#include <algorithm>
+
+#include "relax.hpp"
+#include "isa.hpp"
+
+// How far a short branch can be from a site that grows and still be moved
+// by it: a branch that fits its field spans no more than the field reaches,
+// and relaxation only ever lengthens spans
+constexpr int NEAR_WINDOW = 4096;
+
+//
+// The growth of the sites, summed by site index (a Fenwick tree)
+//
+class Growth {
+public:
+    explicit Growth(size_t count) : tree(count + 1, 0) {}
+    
+    void add(size_t i, int delta) {
+        total += delta;
+        for (++i; i<tree.size(); i += i & -i) {
+            tree[i] += delta;
+        }
+    }
+    
+    // Growth of the sites before site i
+    int before(size_t i) const {
+        if (total == 0) return 0;
+        int sum = 0;
+        for (; i>0; i -= i & -i) {
+            sum += tree[i];
+        }
+        return sum;
+    }
+    
+    int total = 0;
+private:
+    std::vector<int> tree;
+};
+
+//
+// Index of the first site at or after lc
+//
+static size_t findSite(const std::vector<Site> &sites, int lc) {
+    auto it = std::lower_bound(sites.begin(), sites.end(), lc, [](const Site &site, int lc) {
+        return site.lc < lc;
+    });
+    return it - sites.begin();
+}
+
+//
+// True if a site can grow no further
+//
+static bool isFinal(const Site &site, const SymbolTable *symbols) {
+    if (!symbols->isDefined(site.sym)) return true;
+    return site.size == (site.kind == SiteJal ? 8 : 12);
+}
+
+//
+// Widens the sites whose labels are out of reach, and moves the labels
+// Sites must be in address order. Every site is checked once; after that
+// only the sites spanning one that grew go back on the worklist, so sites
+// far from any long jump are never looked at again. Sites never shrink,
+// so the worklist runs dry. Returns true if any site grew.
+//
+bool relax(std::vector<Site> &sites, SymbolTable *symbols) {
+    size_t count = sites.size();
+    Growth growth(count);
+    
+    auto move = [&](int lc) { return lc + growth.before(findSite(sites, lc)); };
+    
+    // The size of a site at the current addresses
+    auto needed = [&](size_t i) {
+        const Site &site = sites[i];
+        int offset = move(symbols->getAddress(site.sym)) - (site.lc + growth.before(i));
+        if (site.kind == SiteJal) return fitsJal(offset) ? 4 : 8;
+        if (site.size == 4 && fitsBranch(offset)) return 4;
+        return fitsJal(offset - 4) ? 8 : 12;
+    };
+    
+    // Sites are swept in address order; from sweep on, none has been
+    // checked yet, and they all count as queued
+    size_t sweep = 0;
+    std::vector<size_t> work;
+    std::vector<bool> queued(count, true);
+    
+    // The offset of a site changes if a site between it and its label grows
+    auto spans = [&](size_t k, int lc) {
+        int target = symbols->getAddress(sites[k].sym);
+        return lc >= std::min(sites[k].lc, target) && lc < std::max(sites[k].lc, target);
+    };
+    
+    // The short branches, chained so a scan skips every other site in
+    // one step (a union-find with path halving)
+    std::vector<size_t> nextShort(count + 1);
+    for (size_t k = 0; k<=count; k++) {
+        nextShort[k] = k < count && sites[k].kind == SiteJal ? k + 1 : k;
+    }
+    auto findShort = [&](size_t k) {
+        while (nextShort[k] != k) {
+            nextShort[k] = nextShort[nextShort[k]];
+            k = nextShort[k];
+        }
+        return k;
+    };
+    
+    // A short branch spans at most a few thousand sites, so the ones a
+    // growing site moves are found right away. The sites that reach as far
+    // as a jal can span most of the program; they are checked in rounds,
+    // against every site that grew since the last round.
+    std::vector<int> grown;
+    while (true) {
+        while (!work.empty() || sweep < count) {
+            size_t i = sweep;
+            if (work.empty()) {
+                ++sweep;
+            } else {
+                i = work.back();
+                work.pop_back();
+            }
+            queued[i] = false;
+            
+            Site &site = sites[i];
+            if (isFinal(site, symbols)) continue;
+            int size = needed(i);
+            if (size <= site.size) continue;
+            
+            if (site.kind == SiteBranch) nextShort[i] = i + 1;
+            growth.add(i, size - site.size);
+            site.size = (uint8_t)size;
+            grown.push_back(site.lc);
+            
+            size_t last = std::min(sweep, findSite(sites, site.lc + NEAR_WINDOW + 1));
+            for (size_t k = findShort(findSite(sites, site.lc - NEAR_WINDOW)); k<last; k = findShort(k + 1)) {
+                if (queued[k] || !spans(k, site.lc)) continue;
+                queued[k] = true;
+                work.push_back(k);
+            }
+        }
+        
+        if (grown.empty()) break;
+        std::sort(grown.begin(), grown.end());
+        for (size_t k = count; k-->0;) {
+            if (queued[k] || isFinal(sites[k], symbols) || (sites[k].kind == SiteBranch && sites[k].size == 4)) continue;
+            
+            int target = symbols->getAddress(sites[k].sym);
+            auto first = std::lower_bound(grown.begin(), grown.end(), std::min(sites[k].lc, target));
+            if (first == grown.end() || *first >= std::max(sites[k].lc, target)) continue;
+            queued[k] = true;
+            work.push_back(k);
+        }
+        grown.clear();
+    }
+    
+    if (growth.total == 0) return false;
+    
+    for (size_t i = 0; i<count; i++) {
+        sites[i].at = sites[i].lc + growth.before(i);
+    }
+    for (size_t id = 0; id<symbols->size(); id++) {
+        if (symbols->isDefined(id)) symbols->define(id, move(symbols->getAddress(id)));
+    }
+    return true;
+}
+
+//
+// Where an address from before relaxation ends up
+// Every site before it moves it by the bytes the site grew.
+//
+int relaxedAddress(const std::vector<Site> &sites, int lc) {
+    size_t i = findSite(sites, lc);
+    if (i < sites.size()) return lc + sites[i].at - sites[i].lc;
+    if (sites.empty()) return lc;
+    
+    const Site &last = sites.back();
+    return lc + last.at + last.size - 4 - last.lc;
+}
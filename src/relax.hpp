@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "symtab.hpp"
+
+//
+// Branch and jump relaxation
+// A branch reaches 4KB either way and a jal 1MB. Pass 1 records every
+// branch and jal with a label operand as a site; relax() then widens the
+// sites whose label is out of reach and moves the labels after them.
+//
+//   branch, 4 bytes:   beq rs1, rs2, label
+//   branch, 8 bytes:   bne rs1, rs2, +8;  jal x0, label
+//   branch, 12 bytes:  bne rs1, rs2, +12; auipc x6, hi; jalr x0, x6, lo
+//   jal, 8 bytes:      auipc rd, hi; jalr rd, rd, lo
+//
+// The long forms clobber x6: the far branch always, and the long jal
+// when its rd is x0.
+//
+enum SiteKind : uint8_t {
+    SiteBranch,
+    SiteJal
+};
+
+struct Site {
+    int lc;             // Address before relaxation
+    int sym;
+    SiteKind kind;
+    uint8_t size;       // Bytes once relaxed
+    int at;             // Address once relaxed
+};
+
+// The scratch register of the long forms
+constexpr int RELAX_SCRATCH = 6;
+
+bool relax(std::vector<Site> &sites, SymbolTable *symbols);
+int relaxedAddress(const std::vector<Site> &sites, int lc);
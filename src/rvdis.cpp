@@ -0,0 +1,78 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <cstdio>
+
+#include "mapfile.hpp"
+#include "disasm.hpp"
+#include "pool.hpp"
+
+//
+// Disassembles a flat binary into source rvas accepts
+// Prints the listing to standard output, or to the file given with -o.
+//
+int main(int argc, char **argv) {
+    std::string input = "";
+    std::string output = "-";
+    DisasmOptions options;
+    options.jobs = std::thread::hardware_concurrency();
+    for (int i = 1; i<argc; i++) {
+        std::string arg = argv[i];
+        bool takesValue = arg == "-o" || arg == "-j";
+        if (takesValue && i + 1 >= argc) {
+            std::cerr << "Error: " << arg << " needs a value." << std::endl;
+            return 1;
+        }
+        
+        if (arg == "-o") {
+            output = std::string(argv[i+1]);
+            ++i;
+        } else if (arg == "-j") {
+            if (!parseJobs(argv[i+1], options.jobs)) {
+                std::cerr << "Error: -j needs a positive number of threads, not " << argv[i+1] << "." << std::endl;
+                return 1;
+            }
+            ++i;
+        } else if (arg == "-a") {
+            options.addresses = true;
+        } else {
+            input = argv[i];
+        }
+    }
+    
+    if (input.empty()) {
+        std::cerr << "Usage: rvdis [-o <file>] [-j <n>] [-a] <image>" << std::endl;
+        return 1;
+    }
+    
+    MappedFile *image = new MappedFile(input);
+    if (!image->isOpen()) {
+        std::cerr << "Error: Unable to open " << input << "." << std::endl;
+        delete image;
+        return 1;
+    }
+    
+    FILE *file = stdout;
+    if (output != "-") {
+        file = fopen(output.c_str(), "wb");
+        if (!file) {
+            std::cerr << "Error: Unable to open " << output << "." << std::endl;
+            delete image;
+            return 1;
+        }
+    }
+    
+    Disassembly result = disassemble(image->getText(), options, [&](std::string_view part) {
+        fwrite(part.data(), 1, part.length(), file);
+    });
+    
+    if (file != stdout) fclose(file);
+    delete image;
+    
+    if (result.lost > 0) {
+        std::cerr << "Warning: " << result.lost << " words contain a '\"' and were written as comments; "
+                  << "the listing will not assemble back to the same image." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <cstdint>
+
+#include "scan.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+//
+// The scalar scanners
+// These also finish off the tail of the vector scanners
+//
+static const char *scalarDelimiter(const char *pos, const char *end) {
+    while (pos < end && !delimiterTable.match[(uint8_t)*pos]) ++pos;
+    return pos;
+}
+
+static const char *scalarNonSpace(const char *pos, const char *end) {
+    while (pos < end && *pos == ' ') ++pos;
+    return pos;
+}
+
+static const char *scalarByte(const char *pos, const char *end, char c) {
+    while (pos < end && *pos != c) ++pos;
+    return pos;
+}
+
+#ifdef SCAN_X86
+
+//
+// The SSE2 scanners (16 bytes at a time)
+//
+static const char *sse2Delimiter(const char *pos, const char *end) {
+    while (end - pos >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)pos);
+        __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\"')));
+        
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return scalarDelimiter(pos, end);
+}
+
+static const char *sse2NonSpace(const char *pos, const char *end) {
+    while (end - pos >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)pos);
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' '))) & 0xFFFF;
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return scalarNonSpace(pos, end);
+}
+
+static const char *sse2Byte(const char *pos, const char *end, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    while (end - pos >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)pos);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return scalarByte(pos, end, c);
+}
+
+//
+// The AVX2 scanners (32 bytes at a time)
+//
+__attribute__((target("avx2")))
+static const char *avx2Delimiter(const char *pos, const char *end) {
+    while (end - pos >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)pos);
+        __m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"')));
+        
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return sse2Delimiter(pos, end);
+}
+
+__attribute__((target("avx2")))
+static const char *avx2NonSpace(const char *pos, const char *end) {
+    while (end - pos >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)pos);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return sse2NonSpace(pos, end);
+}
+
+__attribute__((target("avx2")))
+static const char *avx2Byte(const char *pos, const char *end, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    while (end - pos >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)pos);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask) return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return sse2Byte(pos, end, c);
+}
+
+#endif
+
+//
+// The scanners for each level
+//
+static const Scanner scanners[] = {
+    { scalarDelimiter, scalarNonSpace, scalarByte, ScanScalar },
+#ifdef SCAN_X86
+    { sse2Delimiter, sse2NonSpace, sse2Byte, ScanSse2 },
+    { avx2Delimiter, avx2NonSpace, avx2Byte, ScanAvx2 },
+#endif
+};
+
+//
+// The best level the CPU can run
+// Detected once; it never changes afterwards
+//
+ScanLevel getBestScanLevel() {
+    static const ScanLevel best = []() {
+#ifdef SCAN_X86
+        if (__builtin_cpu_supports("avx2")) return ScanAvx2;
+        if (__builtin_cpu_supports("sse2")) return ScanSse2;
+#endif
+        return ScanScalar;
+    }();
+    return best;
+}
+
+//
+// Picks the scanners for a level
+// Levels the CPU cannot run are clamped to the best one it can
+//
+const Scanner &getScanner(ScanLevel level) {
+    ScanLevel best = getBestScanLevel();
+    if (level > best) level = best;
+    return scanners[level];
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+//
+// Byte scanners used by the lexer
+// Each scanner returns a pointer to the first matching byte in [pos, end),
+// or end if there is none. The x86 versions build a bitmask of matches 16
+// (SSE2) or 32 (AVX2) bytes at a time. Each lexer holds the set it uses,
+// by default the best one the CPU supports; there is no shared, mutable
+// choice.
+//
+enum ScanLevel {
+    ScanScalar,
+    ScanSse2,
+    ScanAvx2
+};
+
+struct Scanner {
+    const char *(*delimiter)(const char *pos, const char *end);
+    const char *(*nonSpace)(const char *pos, const char *end);
+    const char *(*byte)(const char *pos, const char *end, char c);
+    ScanLevel level;
+};
+
+
+struct DelimiterTable {
+    bool match[256] = {};
+    
+    constexpr DelimiterTable() {
+        const char *delimiters = " \n,():;\"";
+        for (int i = 0; delimiters[i] != 0; i++) {
+            match[(uint8_t)delimiters[i]] = true;
+        }
+    }
+};
+
+inline constexpr DelimiterTable delimiterTable;
+
+ScanLevel getBestScanLevel();
+const Scanner &getScanner(ScanLevel level);
+
+// Finds the next space, newline, ',', '(', ')', ':', ';' or '"'
+// Most lexemes are only a few bytes long, so the first bytes are checked
+// inline before handing off to the vector scanner.
+inline const char *scanDelimiter(const Scanner &scanner, const char *pos, const char *end) {
+    for (int i = 0; i<8 && pos < end; i++, pos++) {
+        if (delimiterTable.match[(uint8_t)*pos]) return pos;
+    }
+    return scanner.delimiter(pos, end);
+}
+
+// Finds the next byte that is not a space
+inline const char *scanNonSpace(const Scanner &scanner, const char *pos, const char *end) {
+    return scanner.nonSpace(pos, end);
+}
+
+// Finds the next occurrence of c
+inline const char *scanByte(const Scanner &scanner, const char *pos, const char *end, char c) {
+    return scanner.byte(pos, end, c);
+}
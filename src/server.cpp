@@ -0,0 +1,173 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "server.hpp"
+#include "assemble.hpp"
+
+//
+// Reads exactly length bytes; false if the peer went away first
+//
+static bool readAll(int fd, void *data, size_t length) {
+    char *pos = (char *)data;
+    while (length > 0) {
+        ssize_t count = read(fd, pos, length);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        pos += count;
+        length -= count;
+    }
+    return true;
+}
+
+//
+// Writes every buffer in one go where the kernel allows it
+//
+static bool writeAll(int fd, struct iovec *parts, int count) {
+    while (count > 0) {
+        struct msghdr msg = {};
+        msg.msg_iov = parts;
+        msg.msg_iovlen = count;
+        
+        // MSG_NOSIGNAL: a client that hangs up must not kill the server
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0) return false;
+        
+        while (count > 0 && (size_t)sent >= parts->iov_len) {
+            sent -= parts->iov_len;
+            ++parts;
+            --count;
+        }
+        if (count > 0) {
+            parts->iov_base = (char *)parts->iov_base + sent;
+            parts->iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+//
+// Sends the response to one request
+//
+static bool sendResult(int fd, Assembly &result) {
+    uint8_t header[8];
+    putLength(header, (uint32_t)result.image.bytes.size());
+    putLength(header + 4, (uint32_t)result.errors.length());
+    struct iovec parts[3] = {
+        { header, sizeof(header) },
+        { result.image.bytes.data(), result.image.bytes.size() },
+        { &result.errors[0], result.errors.length() }
+    };
+    return writeAll(fd, parts, 3);
+}
+
+//
+// Serves requests on a connection until the client closes it
+// The source buffer is kept between requests, so a warm connection does
+// not allocate for it. A request that is too large is answered with an
+// error, and the connection closed, since its source is never read.
+//
+static void serveConnection(int fd) {
+    std::string source = "";
+    uint8_t word[4];
+    while (readAll(fd, word, sizeof(word))) {
+        uint32_t length = getLength(word);
+        if (length > MAX_REQUEST) {
+            Assembly result;
+            result.errors = "Error: Request of " + std::to_string(length) + " bytes is larger than the limit of "
+                + std::to_string(MAX_REQUEST) + " bytes.\n";
+            sendResult(fd, result);
+            break;
+        }
+        
+        source.resize(length);
+        if (!readAll(fd, &source[0], length)) break;
+        
+        Assembly result = assemble(source);
+        if (!sendResult(fd, result)) break;
+    }
+    close(fd);
+}
+
+static void acceptLoop(int listener) {
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            std::cerr << "Error: accept failed: " << strerror(errno) << "." << std::endl;
+            
+            // Wakes the other threads, so the server exits
+            shutdown(listener, SHUT_RDWR);
+            return;
+        }
+        
+        // A client that goes quiet is dropped, so it cannot hold a thread
+        struct timeval timeout = { IDLE_TIMEOUT, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serveConnection(fd);
+    }
+}
+
+//
+// Listens on path and serves clients until the process is stopped
+// Every thread blocks in accept() on the same socket, and the kernel
+// hands each new connection to one of them.
+//
+int serve(const std::string &path, unsigned threads) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: Socket path " << path << " is too long." << std::endl;
+        return 1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+    
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Error: Unable to create a socket: " << strerror(errno) << "." << std::endl;
+        return 1;
+    }
+    
+    // Only a socket left over from an earlier server is replaced
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            std::cerr << "Error: " << path << " exists and is not a socket." << std::endl;
+            close(listener);
+            return 1;
+        }
+        unlink(path.c_str());
+    }
+    
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, SOMAXCONN) < 0) {
+        std::cerr << "Error: Unable to listen on " << path << ": " << strerror(errno) << "." << std::endl;
+        close(listener);
+        return 1;
+    }
+    
+    if (threads == 0) threads = 1;
+    std::cerr << "Serving on " << path << " with " << threads << " threads" << std::endl;
+    
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i<threads; i++) {
+        workers.emplace_back(acceptLoop, listener);
+    }
+    acceptLoop(listener);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    
+    close(listener);
+    unlink(path.c_str());
+    return 1;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//
+// The assembler server
+// Clients connect to a Unix domain socket and send any number of requests
+// over the connection. All integers are 32-bit little-endian.
+//
+//   Request:  length, then length bytes of source
+//   Response: image length, errors length, the image, then the errors
+//
+// Each of the threads accepts and serves one connection at a time, so up
+// to threads connections are served at once. A connection that sends or
+// takes nothing for IDLE_TIMEOUT seconds is closed. A request over
+// MAX_REQUEST gets an empty image and an error, and the connection is
+// closed.
+//
+constexpr uint32_t MAX_REQUEST = 64 << 20;
+constexpr int IDLE_TIMEOUT = 10;
+
+// Encodes and decodes the protocol's integers, whatever the host order
+inline void putLength(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+inline uint32_t getLength(const uint8_t *in) {
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+int serve(const std::string &path, unsigned threads);
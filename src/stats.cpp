@@ -0,0 +1,113 @@
+#include <ctime>
+#include <iomanip>
+#include <sys/resource.h>
+
+#include "stats.hpp"
+
+static double wallTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double cpuTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+PhaseTimer::PhaseTimer(Stats *stats) : stats(stats) {
+    if (!stats) return;
+    wall = wallTime();
+    cpu = cpuTime();
+}
+
+//
+// Adds the time since the last lap to a phase
+//
+void PhaseTimer::lap(Phase phase) {
+    if (!stats) return;
+    double nowWall = wallTime();
+    double nowCpu = cpuTime();
+    stats->phases[phase].wall += nowWall - wall;
+    stats->phases[phase].cpu += nowCpu - cpu;
+    wall = nowWall;
+    cpu = nowCpu;
+}
+
+//
+// True if the per-operation counters were compiled in
+//
+bool countersEnabled() {
+#ifdef RVAS_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+long getPeakRss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+//
+// Prints the report, as a table or as one JSON object
+// Counters that were not compiled in are "n/a", or null in JSON.
+//
+void Stats::print(std::ostream &out, bool json) const {
+    static const char *names[PhaseCount] = { "lex", "pass1", "pass2", "write" };
+    bool counters = countersEnabled();
+    
+    if (json) {
+        auto counter = [&](size_t value) {
+            if (counters) out << value;
+            else out << "null";
+        };
+        
+        out << "{\"phases\":{";
+        for (int i = 0; i<PhaseCount; i++) {
+            if (i > 0) out << ",";
+            out << "\"" << names[i] << "\":{\"wall\":" << phases[i].wall << ",\"cpu\":" << phases[i].cpu << "}";
+        }
+        out << "},\"tokens\":" << tokens << ",\"instructions\":" << instructions
+            << ",\"bytes_in\":" << bytesIn << ",\"bytes_out\":" << bytesOut
+            << ",\"symbols\":" << symbols << ",\"lookups\":";
+        counter(lookups);
+        out << ",\"probes\":";
+        counter(probes);
+        out << ",\"allocations\":";
+        counter(allocations);
+        out << ",\"allocated_bytes\":";
+        counter(allocatedBytes);
+        out << ",\"peak_rss_kb\":" << peakRss << "}" << std::endl;
+        return;
+    }
+    
+    double wall = 0;
+    double cpu = 0;
+    out << std::fixed << std::setprecision(6);
+    out << "phase        wall (s)     cpu (s)" << std::endl;
+    for (int i = 0; i<PhaseCount; i++) {
+        wall += phases[i].wall;
+        cpu += phases[i].cpu;
+        out << std::left << std::setw(8) << names[i] << std::right
+            << std::setw(12) << phases[i].wall << std::setw(12) << phases[i].cpu << std::endl;
+    }
+    out << std::left << std::setw(8) << "total" << std::right
+        << std::setw(12) << wall << std::setw(12) << cpu << std::endl;
+    out << "tokens:       " << tokens << std::endl;
+    out << "instructions: " << instructions << std::endl;
+    out << "bytes in:     " << bytesIn << std::endl;
+    out << "bytes out:    " << bytesOut << std::endl;
+    out << "symbols:      " << symbols << std::endl;
+    if (counters) {
+        out << "lookups:      " << lookups << " (" << probes << " extra probes)" << std::endl;
+        out << "allocations:  " << allocations << " (" << allocatedBytes << " bytes)" << std::endl;
+    } else {
+        out << "lookups:      n/a (build with RVAS_STATS)" << std::endl;
+        out << "allocations:  n/a (build with RVAS_STATS)" << std::endl;
+    }
+    out << "peak RSS:     " << peakRss << " KB" << std::endl;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+
+//
+// Instrumentation for --stats
+// Phase times and the totals are taken a few times per assembly, so they
+// are always available. The per-operation counters (symbol table probes,
+// heap allocations) are only compiled in with RVAS_STATS; otherwise
+// STATS() drops the statement and the hot paths are unchanged.
+//
+#ifdef RVAS_STATS
+#define STATS(statement) statement
+#else
+#define STATS(statement)
+#endif
+
+//
+// A counter that threads can bump at the same time
+// Relaxed, since only the total is read, once the threads are done.
+// Copies take the current count, so objects holding one stay copyable.
+//
+class Counter {
+public:
+    Counter() = default;
+    Counter(const Counter &other) : value(other.get()) {}
+    Counter &operator=(const Counter &other) {
+        value.store(other.get(), std::memory_order_relaxed);
+        return *this;
+    }
+    
+    void operator++() { value.fetch_add(1, std::memory_order_relaxed); }
+    size_t get() const { return value.load(std::memory_order_relaxed); }
+private:
+    std::atomic<size_t> value{0};
+};
+
+enum Phase {
+    PhaseLex,
+    PhasePass1,
+    PhasePass2,
+    PhaseWrite,
+    PhaseCount
+};
+
+struct PhaseTime {
+    double wall = 0;
+    double cpu = 0;         // Every thread of the process
+};
+
+struct Stats {
+    PhaseTime phases[PhaseCount];
+    size_t tokens = 0;
+    size_t instructions = 0;
+    size_t bytesIn = 0;
+    size_t bytesOut = 0;
+    size_t symbols = 0;
+    size_t lookups = 0;         // Symbol table lookups
+    size_t probes = 0;          // Slots looked at past the first
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+    long peakRss = 0;           // KB
+    
+    void print(std::ostream &out, bool json) const;
+};
+
+//
+// Times consecutive phases
+// Does nothing without a Stats to record into.
+//
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Stats *stats);
+    void lap(Phase phase);
+private:
+    Stats *stats;
+    double wall = 0;
+    double cpu = 0;
+};
+
+bool countersEnabled();
+long getPeakRss();
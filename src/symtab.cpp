@@ -0,0 +1,93 @@
+#include <cstring>
+
+#include "symtab.hpp"
+#include "stats.hpp"
+
+SymbolTable::SymbolTable() {
+    slots.assign(1024, -1);
+}
+
+//
+// Returns the id of a name, adding it if it is new
+//
+int SymbolTable::intern(std::string_view name) {
+    uint32_t h = hash(name);
+    size_t slot = probe(name, h);
+    if (slots[slot] != -1) return slots[slot];
+    
+    // Keep the load factor at or under one half
+    if ((symbols.size() + 1) * 2 > slots.size()) {
+        grow();
+        slot = probe(name, h);
+    }
+    
+    int id = (int)symbols.size();
+    symbols.push_back({ h, (uint32_t)names.length(), (uint32_t)name.length(), 0, false });
+    names.append(name.data(), name.length());
+    slots[slot] = id;
+    return id;
+}
+
+//
+// Returns the id of a name, or -1 if it was never interned
+//
+int SymbolTable::find(std::string_view name) const {
+    return slots[probe(name, hash(name))];
+}
+
+void SymbolTable::define(int id, int address) {
+    symbols[id].address = address;
+    symbols[id].defined = true;
+}
+
+std::string_view SymbolTable::getName(int id) const {
+    const Symbol &symbol = symbols[id];
+    return std::string_view(names.data() + symbol.offset, symbol.length);
+}
+
+//
+// FNV-1a
+//
+uint32_t SymbolTable::hash(std::string_view name) {
+    uint32_t h = 2166136261u;
+    for (char c : name) {
+        h ^= (uint8_t)c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//
+// Finds the slot that holds a name, or the empty slot where it would go
+//
+size_t SymbolTable::probe(std::string_view name, uint32_t h) const {
+    size_t mask = slots.size() - 1;
+    size_t slot = h & mask;
+    STATS(++lookups);
+    
+    while (slots[slot] != -1) {
+        const Symbol &symbol = symbols[slots[slot]];
+        if (symbol.hash == h && symbol.length == name.length()
+            && memcmp(names.data() + symbol.offset, name.data(), name.length()) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+        STATS(++probes);
+    }
+    
+    return slot;
+}
+
+//
+// Doubles the slot array and re-inserts every symbol by its stored hash
+//
+void SymbolTable::grow() {
+    slots.assign(slots.size() * 2, -1);
+    size_t mask = slots.size() - 1;
+    
+    for (size_t id = 0; id<symbols.size(); id++) {
+        size_t slot = symbols[id].hash & mask;
+        while (slots[slot] != -1) slot = (slot + 1) & mask;
+        slots[slot] = (int)id;
+    }
+}
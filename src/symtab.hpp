@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "stats.hpp"
+
+//
+// The symbol table
+// Names are interned once and handed out as small, stable integer ids, so
+// the passes never hash or compare strings. Lookups go through an
+// open-addressing hash table with linear probing; the names themselves live
+// in a single arena.
+//
+class SymbolTable {
+public:
+    SymbolTable();
+    
+    int intern(std::string_view name);
+    int find(std::string_view name) const;
+    
+    void define(int id, int address);
+    bool isDefined(int id) const { return symbols[id].defined; }
+    int getAddress(int id) const { return symbols[id].address; }
+    std::string_view getName(int id) const;
+    
+    size_t size() const { return symbols.size(); }
+    
+    // Only counted with RVAS_STATS; find() can run on several threads
+    size_t getLookups() const { return lookups.get(); }
+    size_t getProbes() const { return probes.get(); }
+private:
+    struct Symbol {
+        uint32_t hash;
+        uint32_t offset;        // Offset of the name in the arena
+        uint32_t length;
+        int address;
+        bool defined;
+    };
+    
+    std::vector<Symbol> symbols;    // Indexed by id
+    std::vector<int> slots;         // Symbol id, or -1 if empty
+    std::string names = "";         // The name arena
+    mutable Counter lookups;
+    mutable Counter probes;
+    
+    static uint32_t hash(std::string_view name);
+    size_t probe(std::string_view name, uint32_t hash) const;
+    void grow();
+};
@@ -23,6 +23,9 @@ do
         echo "Expected"
         echo $EXPECTED
         echo ""
+        echo "Disassembly:"
+        build/src/rvdis -a out
+        echo ""
         
         rm out
         exit 1
@@ -0,0 +1,206 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <cstdint>
+#include <algorithm>
+
+#include "assemble.hpp"
+#include "link.hpp"
+#include "disasm.hpp"
+#include "isa.hpp"
+
+//
+// A snippet and the words it must assemble to
+//
+struct Case {
+    std::string source;
+    std::vector<uint32_t> words;
+};
+
+static const Case cases[] = {
+    { "add x1, x2, x3\n", { 0x003100b3 } },
+    { "addi x1, x2, 20\nsw x1, 20(x2)\n", { 0x01410093, 0x00112a23 } },
+    { "jal x12, LABEL\njal x11, LABEL\nLABEL:\n", { 0x0080066f, 0x004005ef } },
+    { "beq x0, x0, LBL2\nLBL1:\naddi x1, x2, 20\naddi x2, x3, 20\nLBL2:\nbeq x0, x0, LBL1\n",
+        { 0x00000663, 0x01410093, 0x01418113, 0xfe000ce3 } },
+    { "flw f10, 23(x1)\nfsw f20, 44(x3)\n", { 0x0170a507, 0x0341a627 } },
+};
+
+static bool check(const Case &test, const Assembly &result) {
+    return result.ok() && result.words() == test.words;
+}
+
+// Snippets assembled from many threads at once all come out right
+static bool checkThreads() {
+    const int threads = 8;
+    const int rounds = 2000;
+    
+    std::atomic<int> failures(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t<threads; t++) {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i<rounds; i++) {
+                const Case &test = cases[(t + i) % (sizeof(cases) / sizeof(cases[0]))];
+                AssembleOptions options;
+                options.singlePass = i % 2 == 1;
+                if (!check(test, assemble(test.source, options))) ++failures;
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    
+    if (failures != 0) {
+        std::cerr << "Error: " << failures << " snippets assembled wrongly." << std::endl;
+        return false;
+    }
+    std::cout << threads * rounds << " snippets assembled on " << threads << " threads" << std::endl;
+    return true;
+}
+
+// Errors come back as diagnostics
+static bool checkErrors() {
+    Assembly bad = assemble("beq x0, x0, nowhere\n");
+    if (bad.ok() || bad.errors.find("nowhere") == std::string::npos) {
+        std::cerr << "Error: An undefined label was not reported." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A relocatable image keeps its undefined labels
+static bool checkRelocatable() {
+    AssembleOptions object;
+    object.relocatable = true;
+    Assembly linked = assemble("lui x5, data\naddi x5, x5, data\njal x1, far\n", object);
+    if (!linked.ok() || linked.image.relocs.size() != 3 || linked.image.relocs[2].type != RelocJal
+        || linked.image.symbols[linked.image.relocs[2].sym].name != "far") {
+        std::cerr << "Error: Undefined labels were not left as relocations." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Linked images match one assembled as a whole
+static bool checkLink() {
+    AssembleOptions object;
+    object.relocatable = true;
+    std::vector<LinkInput> objects(2);
+    objects[0].image = assemble("jal x1, helper\nbeq x0, x0, .Lend\n.Lend:\nhlt\n", object).image;
+    objects[1].image = assemble("helper:\njal x0, .Lend\n.Lend:\nhlt\n", object).image;
+    std::ostringstream linkErrors;
+    Image image;
+    Assembly whole = assemble("jal x1, helper\nbeq x0, x0, .Lend\n.Lend:\nhlt\nhelper:\njal x0, .Lend2\n.Lend2:\nhlt\n");
+    if (!link(objects, 2, image, linkErrors) || image.bytes != whole.image.bytes) {
+        std::cerr << "Error: Linked images differ from one assembled as a whole." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A source split across jobs assembles the same as a serial run
+static bool checkParallel() {
+    std::string big = "";
+    while (big.length() < (4 << 20)) big += cases[3].source;
+    AssembleOptions parallel;
+    parallel.jobs = 4;
+    if (assemble(big).words() != assemble(big, parallel).words()) {
+        std::cerr << "Error: A parallel run differs from a serial one." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Distant labels are reached through longer sequences
+static bool checkRelaxation() {
+    // A branch to 1MB away, a jal to as far, and a branch just past 4KB;
+    // the same split over chunks; and single-pass mode, which cannot relax
+    std::string distant = "beq x1, x2, far\njal x0, far\nbne x1, x2, near\n";
+    for (int i = 0; i<2000; i++) distant += "nop\n";
+    distant += "near:\n";
+    for (int i = 0; i<300000; i++) distant += "nop\n";
+    distant += "far:\nhlt\n";
+    
+    int far = 28 + 302000 * 4;
+    auto hi = [](int offset) { return (int)(((uint32_t)offset + 0x800) >> 12); };
+    std::vector<uint32_t> relaxed = {
+        encode(Bne, 0, 1, 2, 12), encode(Auipc, 6, 0, 0, hi(far - 4)), encode(Jalr, 0, 6, 0, far - 4),
+        encode(Auipc, 6, 0, 0, hi(far - 12)), encode(Jalr, 0, 6, 0, far - 12),
+        encode(Beq, 0, 1, 2, 8), encode(Jal, 0, 0, 0, 8028 - 24)
+    };
+    std::vector<uint32_t> words = assemble(distant).words();
+    AssembleOptions parallel;
+    parallel.jobs = 4;
+    AssembleOptions onePass;
+    onePass.singlePass = true;
+    if (words.size() != (size_t)far / 4 + 1 || !std::equal(relaxed.begin(), relaxed.end(), words.begin())
+        || assemble(distant, parallel).words() != words || assemble(distant, onePass).errors.find("out of range") == std::string::npos) {
+        std::cerr << "Error: Distant labels were not relaxed." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Disassembled images assemble back to the same bytes
+static bool checkRoundTrip() {
+    // Every instruction and some data; then the same over many chunks;
+    // then words that mostly do not decode or branch out of the image
+    std::string every = "top:\nnop\nhlt\nadd x1, x2, x3\nsub x4, x5, x6\nsra x7, x8, x9\naddi x1, x2, -20\n"
+        "slli x3, x4, 31\nsrai x3, x4, 7\nlw x1, -8(x2)\nlhu x3, 2047(x4)\nsb x5, -2048(x6)\nsw x7, 20(x8)\n"
+        "beq x1, x2, top\nbgeu x3, x4, end\nlui x5, 1048575\nauipc x6, 1\njal x1, end\njal x0, -64\n"
+        "jalr x0, x1, 4\nflw f10, 23(x1)\nfsw f20, -44(x3)\nfadd.s f2, f3, f4\nfsub.s f31, f30, f29\n"
+        "raw: \"\x01\x02\x03\x04\"\nend:\n";
+    std::string program = "";
+    for (int i = 0; program.length() < (4 << 20); i++) {
+        std::string copy = every;
+        for (std::string label : { "top", "end", "raw" }) {
+            for (size_t at = copy.find(label); at != std::string::npos; at = copy.find(label, at + 1)) {
+                copy.insert(at + label.length(), std::to_string(i));
+            }
+        }
+        program += copy;
+    }
+    
+    Assembly small = assemble(every);
+    Assembly large = assemble(program);
+    std::vector<std::vector<uint8_t>> images = { small.image.bytes, large.image.bytes };
+    uint32_t seed = 12345;
+    images.emplace_back();
+    for (int i = 0; i<100003; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t byte = (uint8_t)(seed >> 16);
+        images.back().push_back(byte == '\"' ? 0 : byte);
+    }
+    
+    for (const std::vector<uint8_t> &original : images) {
+        std::string_view bytes((const char *)original.data(), original.size());
+        std::string listing = "";
+        DisasmOptions disasm;
+        disasm.jobs = 4;
+        Assembly again = assemble(disassemble(bytes, listing, disasm).lost == 0 ? listing : "");
+        if (!small.ok() || !large.ok() || !again.ok() || again.image.bytes != original) {
+            std::cerr << "Error: A disassembled image does not assemble back to the same bytes." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+// Runs every check, so one failure does not hide the others
+//
+int main() {
+    bool ok = true;
+    ok &= checkThreads();
+    ok &= checkErrors();
+    ok &= checkRelocatable();
+    ok &= checkLink();
+    ok &= checkParallel();
+    ok &= checkRelaxation();
+    ok &= checkRoundTrip();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+
+#include "assemble.hpp"
+#include "cache.hpp"
+
+static const char *OUTPUT = "cache_test.bin";
+static const char *CACHE = "cache_test.cache";
+
+static std::string join(const std::vector<std::string> &lines) {
+    std::string source = "";
+    for (const std::string &line : lines) {
+        source += line + "\n";
+    }
+    return source;
+}
+
+static std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+//
+// Reassembles through the cache and checks the output against a full
+// assembly of the same source
+//
+static bool step(const char *name, const std::vector<std::string> &lines, CacheStats &stats) {
+    std::string source = join(lines);
+    std::ostringstream errors;
+    stats = CacheStats();
+    bool written = assembleCached(source, OUTPUT, CACHE, 2, errors, stats);
+    
+    Assembly whole = assemble(source);
+    std::string expected((const char *)whole.image.bytes.data(), whole.image.bytes.size());
+    if (!written || !errors.str().empty() || !whole.ok() || readFile(OUTPUT) != expected) {
+        std::cerr << "Error: " << name << ": the cached output differs from a full assembly." << std::endl;
+        std::cerr << errors.str() << whole.errors;
+        return false;
+    }
+    return true;
+}
+
+//
+// Runs a source through a series of edits: one that keeps every region
+// the same size, one with an error, a label moved from one region into the next, a line
+// inserted in front of every later region, and a branch that has to be
+// relaxed. Each output must match a full assembly byte for byte.
+//
+int main() {
+    // Regions are 1024 lines; Lmove sits on the last line of the first
+    std::vector<std::string> lines;
+    for (int i = 0; i<4000; i++) {
+        if (i % 50 == 0) {
+            lines.push_back("L" + std::to_string(i) + ":");
+        } else if (i % 7 == 0) {
+            lines.push_back("beq x1, x2, L" + std::to_string(std::min((i / 50 + i % 2) * 50, 3950)));
+        } else if (i % 13 == 0) {
+            lines.push_back("jal x1, L" + std::to_string((i + 1500) / 50 * 50 % 4000));
+        } else {
+            lines.push_back("addi x1, x2, " + std::to_string(i % 100));
+        }
+    }
+    lines[1023] = "Lmove:";
+    lines[1024] = "addi x3, x3, 1";
+    lines[1025] = "; pad";
+    lines[10] = "jal x1, Lmove";
+    lines[2501] = "jal x1, Lmove";
+    
+    remove(OUTPUT);
+    remove(CACHE);
+    CacheStats stats;
+    if (!step("first run", lines, stats)) return 1;
+    
+    lines[5] = "addi x1, x2, 99";
+    if (!step("same-size edit", lines, stats)) return 1;
+    if (!stats.incremental || stats.encoded != 1) {
+        std::cerr << "Error: A same-size edit was not patched in place." << std::endl;
+        return 1;
+    }
+    
+    // A source with errors writes nothing, and the cache still describes
+    // the output as it was
+    std::string before = readFile(OUTPUT);
+    std::ostringstream errors;
+    lines[6] = "beq x1, x2, Lnowhere";
+    if (assembleCached(join(lines), OUTPUT, CACHE, 2, errors, stats) || errors.str().empty() || readFile(OUTPUT) != before) {
+        std::cerr << "Error: A source with errors was written." << std::endl;
+        return 1;
+    }
+    lines[6] = "addi x1, x2, 6";
+    if (!step("fixed error", lines, stats)) return 1;
+    if (!stats.incremental || stats.encoded != 0) {
+        std::cerr << "Error: A failed run changed the cache." << std::endl;
+        return 1;
+    }
+    
+    // Both regions keep their size, but Lmove moves one word on, so the
+    // regions that refer to it are encoded again
+    lines[1023] = "; pad";
+    lines[1025] = "Lmove:";
+    if (!step("moved label", lines, stats)) return 1;
+    if (!stats.incremental || stats.encoded != 3) {
+        std::cerr << "Error: A moved label did not re-encode exactly the regions using it." << std::endl;
+        return 1;
+    }
+    
+    lines.insert(lines.begin() + 100, "add x1, x2, x3");
+    if (!step("inserted line", lines, stats)) return 1;
+    
+    // A branch past 1MB forces a full assembly, and no cache is kept
+    lines.insert(lines.begin(), "beq x1, x2, Lfar");
+    lines.insert(lines.end(), 300000, "nop");
+    lines.push_back("Lfar:");
+    lines.push_back("hlt");
+    if (!step("relaxed branch", lines, stats)) return 1;
+    if (stats.incremental || access(CACHE, F_OK) == 0) {
+        std::cerr << "Error: A source that needs relaxing was cached." << std::endl;
+        return 1;
+    }
+    if (!step("run after relaxing", lines, stats)) return 1;
+    
+    remove(OUTPUT);
+    remove(CACHE);
+    std::cout << "Cached output matched a full assembly after every edit" << std::endl;
+    return 0;
+}
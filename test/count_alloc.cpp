@@ -0,0 +1,27 @@
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include "count_alloc.hpp"
+
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+size_t countAllocations() {
+    return allocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+//
+// Counting allocator for the tests
+// A test linked with count_alloc.cpp has the global operator new replaced,
+// so every heap allocation in the process is counted.
+//
+size_t countAllocations();
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include "lex.hpp"
+#include "symtab.hpp"
+#include "count_alloc.hpp"
+
+//
+// Lexes a source that touches every kind of token and checks that, once the
+// scanner is constructed and the labels are interned, producing tokens
+// never allocates
+//
+int main() {
+    std::string line = "LABEL: \"a string\"\n"
+                       "add x1, x2, x3 ; a comment\n"
+                       "addi x5, x0, -10\n"
+                       "lw x1, 20(x2)\n"
+                       "sw x1, 20(sp)\n"
+                       "beq x4, x5, LABEL\n"
+                       "jal ra, LABEL\n"
+                       "fadd.s f1, f2, f3\n"
+                       "flw f1, 4(x2)\n";
+    const int instructions = 8;
+    const int copies = 10000;
+    
+    std::string source = "";
+    source.reserve(line.length() * copies);
+    for (int i = 0; i<copies; i++) source += line;
+    
+    // The first copy interns the labels
+    SymbolTable symbols;
+    Lex warmup(line.data(), line.length());
+    warmup.setSymbols(&symbols);
+    while (warmup.getNext().type != Eof) {}
+    
+    Lex lex(source.data(), source.length());
+    lex.setSymbols(&symbols);
+    
+    size_t before = countAllocations();
+    size_t tokens = 0;
+    Token token = lex.getNext();
+    while (token.type != Eof) {
+        ++tokens;
+        token = lex.getNext();
+    }
+    size_t count = countAllocations() - before;
+    
+    std::cout << tokens << " tokens, " << (instructions * copies) << " instructions, ";
+    std::cout << count << " allocations" << std::endl;
+    
+    if (count != 0) {
+        std::cerr << "Error: The lexer allocated on the steady path." << std::endl;
+        return 1;
+    }
+    return 0;
+}
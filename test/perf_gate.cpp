@@ -0,0 +1,310 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "corpus.hpp"
+#include "lex.hpp"
+#include "symtab.hpp"
+#include "count_alloc.hpp"
+#include "pass1.hpp"
+#include "pass2.hpp"
+#include "output.hpp"
+
+//
+// The performance gate
+// Assembles fixed synthetic corpora phase by phase and checks each phase
+// against the budgets in the baseline file: a floor on throughput and a
+// ceiling on heap allocations per instruction.
+//
+// Throughput depends on the machine, so it is divided by the speed of a
+// fixed calibration loop before it is compared, and budgets are kept per
+// build type. A build type with no budgets only has its allocations
+// checked against the budgets of any other type, since those do not
+// depend on the machine.
+//
+// "perf_gate --update <baseline>" measures again and rewrites the budgets
+// of the current build type; they are only ever changed that way.
+//
+
+#ifndef RVAS_BUILD_TYPE
+#define RVAS_BUILD_TYPE ""
+#endif
+
+// A phase fails below this fraction of its recorded throughput
+constexpr double THROUGHPUT_MARGIN = 0.5;
+
+// Timed runs per corpus; the best time of each phase counts
+constexpr int REPEATS = 3;
+
+using Clock = std::chrono::steady_clock;
+
+static double since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+enum GatePhase { GateLex, GatePass1, GatePass2, GateOutput, GatePhaseCount };
+static const char *phaseNames[GatePhaseCount] = { "lex", "pass1", "pass2", "output" };
+
+struct Measure {
+    double seconds[GatePhaseCount] = {};
+    size_t allocations[GatePhaseCount] = {};
+    size_t instructions = 0;
+};
+
+//
+// One budget line of the baseline:
+// <build type> <corpus> <phase> <min score> <max allocations per million instructions>
+//
+struct Budget {
+    std::string build;
+    std::string corpus;
+    std::string phase;
+    double score;
+    double allocations;
+};
+
+//
+// Hashes a fixed buffer; the result is in MB/s
+// Scores are instructions per second divided by this, so a faster or
+// slower machine moves both alike.
+//
+static double calibrate() {
+    std::vector<uint8_t> buffer(8 << 20);
+    for (size_t i = 0; i<buffer.size(); i++) buffer[i] = (uint8_t)(i * 31);
+    
+    double best = 0;
+    volatile uint32_t sink = 0;
+    for (int run = 0; run<REPEATS; run++) {
+        auto start = Clock::now();
+        uint32_t h = 2166136261u;
+        for (uint8_t c : buffer) {
+            h ^= c;
+            h *= 16777619u;
+        }
+        sink = h;
+        double secs = since(start);
+        if (best == 0 || secs < best) best = secs;
+    }
+    (void)sink;
+    return buffer.size() / best / 1e6;
+}
+
+//
+// Assembles the source once, timing each phase and counting what it
+// allocates
+//
+static void runPhases(const std::string &source, FILE *null, Measure &measure) {
+    std::ostringstream errors;
+    SymbolTable *symbols = new SymbolTable;
+    double secs[GatePhaseCount];
+    size_t counts[GatePhaseCount];
+    
+    size_t before = countAllocations();
+    auto start = Clock::now();
+    Lex *lex = new Lex(source.data(), source.length());
+    lex->setSymbols(symbols);
+    std::vector<Token> tokens = lex->tokenize();
+    secs[GateLex] = since(start);
+    counts[GateLex] = countAllocations() - before;
+    
+    before = countAllocations();
+    start = Clock::now();
+    Lex *lex1 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass1 *pass1 = new Pass1(lex1, symbols);
+    pass1->setErrors(&errors);
+    int size = pass1->run();
+    secs[GatePass1] = since(start);
+    counts[GatePass1] = countAllocations() - before;
+    
+    before = countAllocations();
+    start = Clock::now();
+    Lex *lex2 = new Lex(tokens.data(), tokens.data() + tokens.size());
+    Pass2 *pass2 = new Pass2(lex2, symbols);
+    pass2->setErrors(&errors);
+    pass2->reserve(size);
+    pass2->run();
+    secs[GatePass2] = since(start);
+    counts[GatePass2] = countAllocations() - before;
+    
+    // Hex is formatted word by word, so it has something to measure
+    before = countAllocations();
+    start = Clock::now();
+    Sink *sink = new Sink(null);
+    writeImage(pass2->getImage(), FormatHex, *sink);
+    sink->flush();
+    delete sink;
+    secs[GateOutput] = since(start);
+    counts[GateOutput] = countAllocations() - before;
+    
+    for (int i = 0; i<GatePhaseCount; i++) {
+        if (measure.seconds[i] == 0 || secs[i] < measure.seconds[i]) measure.seconds[i] = secs[i];
+        measure.allocations[i] = counts[i];
+    }
+    measure.instructions = pass2->getImage().bytes.size() / 4;
+    if (!errors.str().empty()) std::cerr << errors.str();
+    
+    delete pass2;
+    delete lex2;
+    delete pass1;
+    delete lex1;
+    delete lex;
+    delete symbols;
+}
+
+static bool readBaseline(const std::string &path, std::vector<Budget> &budgets) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream reader(line);
+        Budget budget;
+        if (reader >> budget.build >> budget.corpus >> budget.phase >> budget.score >> budget.allocations) {
+            budgets.push_back(budget);
+        }
+    }
+    return true;
+}
+
+static bool writeBaseline(const std::string &path, const std::vector<Budget> &budgets) {
+    std::ofstream file(path);
+    if (!file.is_open()) return false;
+    
+    file << "# Performance budgets for the perf_gate test" << std::endl;
+    file << "# Regenerate the lines of one build type with: perf_gate_test --update <this file>" << std::endl;
+    file << "#" << std::endl;
+    file << "# build corpus phase min-score max-allocations" << std::endl;
+    file << "# The score is instructions/sec divided by the calibration loop's MB/s;" << std::endl;
+    file << "# allocations are per million instructions." << std::endl;
+    for (const Budget &budget : budgets) {
+        file << budget.build << " " << budget.corpus << " " << budget.phase << " "
+             << budget.score << " " << budget.allocations << std::endl;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::string path = "";
+    bool update = false;
+    for (int i = 1; i<argc; i++) {
+        if (std::string(argv[i]) == "--update") update = true;
+        else path = argv[i];
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: perf_gate_test [--update] <baseline>" << std::endl;
+        return 1;
+    }
+    
+    std::string build = RVAS_BUILD_TYPE;
+    if (build.empty()) build = "default";
+    
+    std::vector<Budget> budgets;
+    if (!readBaseline(path, budgets) && !update) {
+        std::cerr << "Error: Unable to open " << path << "." << std::endl;
+        return 1;
+    }
+    
+    // The corpora: the default mix, and one heavy on labels, branches
+    // and comments
+    std::vector<std::pair<std::string, CorpusOptions>> corpora(2);
+    corpora[0].first = "mixed";
+    corpora[0].second.lines = 200000;
+    corpora[1].first = "branchy";
+    corpora[1].second.lines = 200000;
+    corpora[1].second.labelEvery = 4;
+    corpora[1].second.commentPercent = 50;
+    parseMix("20,20,10,10,35,5", corpora[1].second.mix);
+    
+    FILE *null = fopen("/dev/null", "wb");
+    if (!null) {
+        std::cerr << "Error: Unable to open /dev/null." << std::endl;
+        return 1;
+    }
+    
+    double calibration = calibrate();
+    std::cout << "build " << build << ", calibration " << std::fixed << std::setprecision(1)
+              << calibration << " MB/s" << std::endl;
+    
+    std::vector<Budget> measured;
+    for (auto &corpus : corpora) {
+        std::string source = generateCorpus(corpus.second);
+        Measure measure;
+        for (int run = 0; run<REPEATS; run++) {
+            runPhases(source, null, measure);
+        }
+        
+        for (int i = 0; i<GatePhaseCount; i++) {
+            double rate = measure.instructions / measure.seconds[i];
+            double perMillion = measure.allocations[i] * 1e6 / measure.instructions;
+            measured.push_back({ build, corpus.first, phaseNames[i], rate / calibration, perMillion });
+        }
+    }
+    fclose(null);
+    
+    if (update) {
+        std::vector<Budget> kept;
+        for (const Budget &budget : budgets) {
+            if (budget.build != build) kept.push_back(budget);
+        }
+        for (Budget budget : measured) {
+            budget.score *= THROUGHPUT_MARGIN;
+            budget.allocations = budget.allocations * 1.25 + 50;
+            kept.push_back(budget);
+        }
+        if (!writeBaseline(path, kept)) {
+            std::cerr << "Error: Unable to write " << path << "." << std::endl;
+            return 1;
+        }
+        std::cout << "Updated the " << build << " budgets in " << path << std::endl;
+        return 0;
+    }
+    
+    int failures = 0;
+    std::cout << std::left << std::setw(9) << "corpus" << std::setw(8) << "phase" << std::right
+              << std::setw(12) << "score" << std::setw(12) << "min" << std::setw(12) << "allocs/M"
+              << std::setw(12) << "max" << std::endl;
+    for (const Budget &now : measured) {
+        const Budget *own = nullptr;
+        const Budget *any = nullptr;
+        for (const Budget &budget : budgets) {
+            if (budget.corpus != now.corpus || budget.phase != now.phase) continue;
+            if (budget.build == build) own = &budget;
+            if (!any) any = &budget;
+        }
+        if (!own) own = any;
+        if (!own) {
+            std::cerr << "Error: No budget for " << now.corpus << " " << now.phase << "." << std::endl;
+            ++failures;
+            continue;
+        }
+        
+        bool timed = own->build == build;
+        bool slow = timed && now.score < own->score;
+        bool heavy = now.allocations > own->allocations;
+        
+        std::cout << std::left << std::setw(9) << now.corpus << std::setw(8) << now.phase << std::right
+                  << std::setprecision(1) << std::setw(12) << now.score;
+        if (timed) std::cout << std::setw(12) << own->score;
+        else std::cout << std::setw(12) << "-";
+        std::cout << std::setprecision(2) << std::setw(12) << now.allocations
+                  << std::setw(12) << own->allocations;
+        if (slow) std::cout << "  SLOW";
+        if (heavy) std::cout << "  ALLOCATES";
+        std::cout << std::endl;
+        
+        if (slow || heavy) ++failures;
+    }
+    
+    if (failures > 0) {
+        std::cerr << "Error: " << failures << " phases are over budget." << std::endl;
+        return 1;
+    }
+    return 0;
+}